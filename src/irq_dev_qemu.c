@@ -10,6 +10,7 @@
 #include "hw/core/qdev-properties.h"
 #include "qemu/module.h"
 #include "qemu/timer.h"
+#include "system/address-spaces.h"
 #include "qapi/error.h"
 #include "qom/object.h"
 
@@ -27,21 +28,53 @@ OBJECT_DECLARE_SIMPLE_TYPE(ISAIrqStormState, ISA_IRQ_STORM_DEVICE)
 #define IRQ_STORM_REG_CFG_WRITES 0x14
 #define IRQ_STORM_REG_EN_TOGGLES 0x18
 #define IRQ_STORM_REG_ACK        0x1c
+#define IRQ_STORM_REG_IRQ_AGE_NS 0x20
+#define IRQ_STORM_REG_DATA       0x24
+#define IRQ_STORM_REG_DATA_LEN   0x28
+#define IRQ_STORM_REG_DATA_BYTES 0x2c
+#define IRQ_STORM_REG_DATA_DROPS 0x30
+#define IRQ_STORM_REG_DATA_UNDER 0x34
+#define IRQ_STORM_REG_FIRST_IRQ  0x38
+#define IRQ_STORM_REG_FIRST_ACK  0x3c
+#define IRQ_STORM_REG_DMA_ADDR_LO  0x40
+#define IRQ_STORM_REG_DMA_ADDR_HI  0x44
+#define IRQ_STORM_REG_DMA_LEN      0x48
+#define IRQ_STORM_REG_DMA_BW_MIBS  0x4c
+#define IRQ_STORM_REG_DMA_BYTES_LO 0x50
+#define IRQ_STORM_REG_DMA_BYTES_HI 0x54
+#define IRQ_STORM_REG_DMA_ERRORS   0x58
+#define IRQ_STORM_REG_CREDITS      0x5c
+#define IRQ_STORM_REG_DEFERRED     0x60
+#define IRQ_STORM_REG_PENDING      0x64
+#define IRQ_STORM_REG_STARVED_US   0x68
+#define IRQ_STORM_REG_DATA_AVAIL   0x6c
+#define IRQ_STORM_REG_END          0x70 /* iosize must cover the whole map */
 
 #define IRQ_STORM_CTRL_ENABLE    BIT(0)
 #define IRQ_STORM_CTRL_LEVEL     BIT(1)
+#define IRQ_STORM_CTRL_DMA       BIT(2)
+#define IRQ_STORM_CTRL_CREDIT    BIT(3)
 
 #define IRQ_STORM_STATUS_ENABLED BIT(0)
 #define IRQ_STORM_STATUS_ASSERT  BIT(1)
 #define IRQ_STORM_STATUS_LEVEL   BIT(2)
 
 #define IRQ_STORM_MAX_BURST      100000U
+#define IRQ_STORM_MAX_DATA_LEN   4096U
+
+#define IRQ_STORM_DMA_TICK_NS    (100 * SCALE_US)
+#define IRQ_STORM_DMA_CHUNK      4096U
+#define IRQ_STORM_MAX_DMA_BW     65536U /* MiB/s */
+
+#define IRQ_STORM_MAX_CREDITS    (1U << 24)
+#define IRQ_STORM_MAX_PENDING    IRQ_STORM_MAX_BURST
 
 struct ISAIrqStormState {
     ISADevice parent_obj;
 
     MemoryRegion io;
     QEMUTimer *timer;
+    QEMUTimer *dma_timer;
     qemu_irq irq;
 
     uint32_t iobase;
@@ -49,6 +82,7 @@ struct ISAIrqStormState {
     uint32_t isairq;
     uint32_t burst;
     uint32_t period_us;
+    uint32_t data_len;
     bool start_enabled;
     bool level_triggered;
 
@@ -59,6 +93,34 @@ struct ISAIrqStormState {
     uint64_t timer_cb_count;
     uint64_t config_writes;
     uint64_t enable_toggle_count;
+    int64_t last_irq_ns;
+    int64_t first_irq_ns;    /* virtual time of the first raise/burst, 0 = none yet */
+    int64_t first_ack_ns;    /* virtual time of the first guest ACK write */
+
+    /* Payload exposed through REG_DATA after each interrupt */
+    uint32_t data_seq;
+    uint32_t data_pos;
+    bool data_valid;
+    uint64_t data_bytes_read;
+    uint64_t data_drops;
+    uint64_t data_underruns;
+
+    /* Background DMA: alternate write and read passes over a guest region */
+    uint64_t dma_addr;
+    uint32_t dma_len;
+    uint32_t dma_bw_mibs;
+    uint32_t dma_pos;
+    bool dma_reading;
+    uint64_t dma_bytes;
+    uint64_t dma_errors;
+    uint8_t dma_buf[IRQ_STORM_DMA_CHUNK];
+
+    /* Credit flow control: one credit per pulse while CTRL_CREDIT is set */
+    uint32_t credits;
+    uint32_t credit_pending;     /* events waiting for credits */
+    uint64_t credit_deferred;    /* events that could not go out on their tick */
+    int64_t starved_since_ns;    /* start of the current starved stretch, 0 = none */
+    int64_t starved_ns;
 };
 
 static uint64_t irq_storm_period_ns(ISAIrqStormState *s)
@@ -66,6 +128,102 @@ static uint64_t irq_storm_period_ns(ISAIrqStormState *s)
     return MAX(1U, s->period_us) * SCALE_US;
 }
 
+/*
+ * Payload byte i of sequence number seq: the first four bytes carry seq
+ * (little endian), the rest (seq + i) so the guest can verify every byte.
+ */
+static uint8_t irq_storm_data_byte(uint32_t seq, uint32_t i)
+{
+    if (i < 4) {
+        return (uint8_t)(seq >> (8 * i));
+    }
+    return (uint8_t)(seq + i);
+}
+
+static void irq_storm_data_new(ISAIrqStormState *s)
+{
+    if (!s->data_len) {
+        return;
+    }
+    if (s->data_valid && s->data_pos < s->data_len) {
+        s->data_drops++;
+    }
+    s->data_seq++;
+    s->data_pos = 0;
+    s->data_valid = true;
+}
+
+static uint32_t irq_storm_data_read(ISAIrqStormState *s, unsigned size)
+{
+    uint32_t val = 0;
+    unsigned i;
+
+    if (!s->data_valid || s->data_pos >= s->data_len) {
+        s->data_underruns++;
+        return 0;
+    }
+    /* A short final access returns the remaining bytes zero-padded */
+    for (i = 0; i < size && s->data_pos < s->data_len; i++) {
+        val |= (uint32_t)irq_storm_data_byte(s->data_seq, s->data_pos++) << (8 * i);
+        s->data_bytes_read++;
+    }
+    return val;
+}
+
+static bool irq_storm_dma_active(ISAIrqStormState *s)
+{
+    return (s->control & IRQ_STORM_CTRL_DMA) && s->dma_len && s->dma_bw_mibs;
+}
+
+static void irq_storm_dma_tick(void *opaque)
+{
+    ISAIrqStormState *s = opaque;
+    uint64_t budget;
+    uint32_t len;
+    MemTxResult res;
+
+    if (!irq_storm_dma_active(s)) {
+        return;
+    }
+
+    budget = ((uint64_t)s->dma_bw_mibs << 20) * IRQ_STORM_DMA_TICK_NS /
+             NANOSECONDS_PER_SECOND;
+    while (budget) {
+        len = MIN(MIN(budget, IRQ_STORM_DMA_CHUNK), s->dma_len - s->dma_pos);
+        if (s->dma_reading) {
+            res = address_space_read(&address_space_memory, s->dma_addr + s->dma_pos,
+                                     MEMTXATTRS_UNSPECIFIED, s->dma_buf, len);
+        } else {
+            res = address_space_write(&address_space_memory, s->dma_addr + s->dma_pos,
+                                      MEMTXATTRS_UNSPECIFIED, s->dma_buf, len);
+        }
+        if (res != MEMTX_OK) {
+            s->dma_errors++;
+        }
+        s->dma_bytes += len;
+        budget -= len;
+        s->dma_pos += len;
+        if (s->dma_pos >= s->dma_len) {
+            s->dma_pos = 0;
+            s->dma_reading = !s->dma_reading;
+        }
+    }
+    timer_mod(s->dma_timer,
+              qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + IRQ_STORM_DMA_TICK_NS);
+}
+
+static void irq_storm_dma_update(ISAIrqStormState *s)
+{
+    if (irq_storm_dma_active(s)) {
+        if (!timer_pending(s->dma_timer)) {
+            timer_mod(s->dma_timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) +
+                      IRQ_STORM_DMA_TICK_NS);
+        }
+    } else {
+        timer_del(s->dma_timer);
+    }
+}
+
 static void irq_storm_irq_deassert(ISAIrqStormState *s)
 {
     if (s->irq_asserted) {
@@ -106,11 +264,74 @@ static void irq_storm_schedule_next(ISAIrqStormState *s)
     timer_mod(s->timer, s->next_deadline_ns);
 }
 
+static void irq_storm_mark_irq(ISAIrqStormState *s)
+{
+    s->last_irq_ns = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    if (!s->first_irq_ns) {
+        s->first_irq_ns = s->last_irq_ns;
+    }
+}
+
+/*
+ * Emit queued plus `fresh` events. With CTRL_CREDIT set each pulse costs one
+ * credit; whatever the credits do not cover stays queued (a level line needs
+ * at most one raise) until the guest grants more through REG_CREDITS.
+ */
+static void irq_storm_emit(ISAIrqStormState *s, uint32_t fresh)
+{
+    bool level = s->control & IRQ_STORM_CTRL_LEVEL;
+    uint64_t queued = s->credit_pending + fresh;
+    uint32_t n;
+    uint32_t i;
+
+    if (level) {
+        if (s->irq_asserted) {
+            return;
+        }
+        queued = MIN(queued, 1);
+    }
+
+    n = queued;
+    if (s->control & IRQ_STORM_CTRL_CREDIT) {
+        n = MIN(queued, s->credits);
+        s->credits -= n;
+        if (n < queued) {
+            s->credit_deferred += MIN(fresh, queued - n);
+            if (!s->starved_since_ns) {
+                s->starved_since_ns = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+            }
+        }
+    }
+    s->credit_pending = MIN(queued - n, IRQ_STORM_MAX_PENDING);
+    if (!n) {
+        return;
+    }
+
+    irq_storm_mark_irq(s);
+    irq_storm_data_new(s);
+    if (level) {
+        qemu_irq_raise(s->irq);
+        s->irq_asserted = true;
+    } else {
+        for (i = 0; i < n; i++) {
+            qemu_irq_pulse(s->irq);
+        }
+    }
+    s->pulses_emitted += n;
+}
+
+/* Close the current credit-starved stretch, if any */
+static void irq_storm_credit_unstarve(ISAIrqStormState *s)
+{
+    if (s->starved_since_ns) {
+        s->starved_ns += qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) - s->starved_since_ns;
+        s->starved_since_ns = 0;
+    }
+}
+
 static void irq_storm_timer_cb(void *opaque)
 {
     ISAIrqStormState *s = opaque;
-    uint32_t i;
-    uint32_t pulses;
 
     if (!(s->control & IRQ_STORM_CTRL_ENABLE)) {
         return;
@@ -118,17 +339,9 @@ static void irq_storm_timer_cb(void *opaque)
 
     s->timer_cb_count++;
     if (s->control & IRQ_STORM_CTRL_LEVEL) {
-        if (!s->irq_asserted) {
-            qemu_irq_raise(s->irq);
-            s->irq_asserted = true;
-            s->pulses_emitted++;
-        }
+        irq_storm_emit(s, s->irq_asserted ? 0 : 1);
     } else {
-        pulses = MIN(MAX(1U, s->burst), IRQ_STORM_MAX_BURST);
-        for (i = 0; i < pulses; i++) {
-            qemu_irq_pulse(s->irq);
-        }
-        s->pulses_emitted += pulses;
+        irq_storm_emit(s, MIN(MAX(1U, s->burst), IRQ_STORM_MAX_BURST));
     }
     irq_storm_schedule_next(s);
 }
@@ -137,7 +350,6 @@ static uint64_t irq_storm_read(void *opaque, hwaddr addr, unsigned size)
 {
     ISAIrqStormState *s = opaque;
     uint8_t status = 0;
-    (void)size;
 
     switch (addr) {
     case IRQ_STORM_REG_CTRL:
@@ -169,6 +381,58 @@ static uint64_t irq_storm_read(void *opaque, hwaddr addr, unsigned size)
         return (uint32_t)s->config_writes;
     case IRQ_STORM_REG_EN_TOGGLES:
         return (uint32_t)s->enable_toggle_count;
+    case IRQ_STORM_REG_IRQ_AGE_NS:
+        /* Virtual time since the last raise/pulse burst, for guest latency */
+        if (!s->last_irq_ns) {
+            return UINT32_MAX;
+        }
+        return MIN(qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) - s->last_irq_ns,
+                   (int64_t)UINT32_MAX);
+    case IRQ_STORM_REG_DATA:
+        return irq_storm_data_read(s, size);
+    case IRQ_STORM_REG_DATA_LEN:
+        return s->data_len;
+    case IRQ_STORM_REG_DATA_BYTES:
+        return (uint32_t)s->data_bytes_read;
+    case IRQ_STORM_REG_DATA_DROPS:
+        return (uint32_t)s->data_drops;
+    case IRQ_STORM_REG_DATA_UNDER:
+        return (uint32_t)s->data_underruns;
+    case IRQ_STORM_REG_FIRST_IRQ:
+        /* Microseconds of virtual time since machine start */
+        return (uint32_t)(s->first_irq_ns / SCALE_US);
+    case IRQ_STORM_REG_FIRST_ACK:
+        return (uint32_t)(s->first_ack_ns / SCALE_US);
+    case IRQ_STORM_REG_DMA_ADDR_LO:
+        return (uint32_t)s->dma_addr;
+    case IRQ_STORM_REG_DMA_ADDR_HI:
+        return (uint32_t)(s->dma_addr >> 32);
+    case IRQ_STORM_REG_DMA_LEN:
+        return s->dma_len;
+    case IRQ_STORM_REG_DMA_BW_MIBS:
+        return s->dma_bw_mibs;
+    case IRQ_STORM_REG_DMA_BYTES_LO:
+        return (uint32_t)s->dma_bytes;
+    case IRQ_STORM_REG_DMA_BYTES_HI:
+        return (uint32_t)(s->dma_bytes >> 32);
+    case IRQ_STORM_REG_DMA_ERRORS:
+        return (uint32_t)s->dma_errors;
+    case IRQ_STORM_REG_CREDITS:
+        return s->credits;
+    case IRQ_STORM_REG_DEFERRED:
+        return (uint32_t)s->credit_deferred;
+    case IRQ_STORM_REG_PENDING:
+        return s->credit_pending;
+    case IRQ_STORM_REG_STARVED_US: {
+        int64_t ns = s->starved_ns;
+        if (s->starved_since_ns) {
+            ns += qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) - s->starved_since_ns;
+        }
+        return (uint32_t)(ns / SCALE_US);
+    }
+    case IRQ_STORM_REG_DATA_AVAIL:
+        /* Unread bytes of the current payload; 0 once drained (reads would underrun) */
+        return s->data_valid && s->data_pos < s->data_len ? s->data_len - s->data_pos : 0;
     default:
         return 0;
     }
@@ -188,7 +452,8 @@ static void irq_storm_write(void *opaque, hwaddr addr, uint64_t val,
 
     switch (addr) {
     case IRQ_STORM_REG_CTRL:
-        new_control = val & (IRQ_STORM_CTRL_ENABLE | IRQ_STORM_CTRL_LEVEL);
+        new_control = val & (IRQ_STORM_CTRL_ENABLE | IRQ_STORM_CTRL_LEVEL |
+                             IRQ_STORM_CTRL_DMA | IRQ_STORM_CTRL_CREDIT);
         if (new_control != old_control) {
             s->config_writes++;
             s->control = new_control;
@@ -212,6 +477,10 @@ static void irq_storm_write(void *opaque, hwaddr addr, uint64_t val,
             timer_del(s->timer);
             irq_storm_irq_deassert(s);
         }
+        if (!(s->control & IRQ_STORM_CTRL_CREDIT)) {
+            irq_storm_credit_unstarve(s);
+        }
+        irq_storm_dma_update(s);
         break;
     case IRQ_STORM_REG_BURST:
         if ((uint32_t)val != s->burst) {
@@ -230,9 +499,60 @@ static void irq_storm_write(void *opaque, hwaddr addr, uint64_t val,
         break;
     case IRQ_STORM_REG_ACK:
         if (val) {
+            if (!s->first_ack_ns) {
+                s->first_ack_ns = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+            }
             irq_storm_irq_deassert(s);
         }
         break;
+    case IRQ_STORM_REG_CREDITS:
+        /*
+         * Grants add to the balance. This is the guest's per-batch hot path, so
+         * it is not counted in config_writes. Queued events go out immediately.
+         */
+        s->credits = MIN((uint64_t)s->credits + (uint32_t)val, IRQ_STORM_MAX_CREDITS);
+        if (s->credits) {
+            irq_storm_credit_unstarve(s);
+            if (s->credit_pending && (s->control & IRQ_STORM_CTRL_ENABLE)) {
+                irq_storm_emit(s, 0);
+            }
+        }
+        break;
+    case IRQ_STORM_REG_DMA_ADDR_LO:
+    case IRQ_STORM_REG_DMA_ADDR_HI: {
+        uint64_t dma_addr = deposit64(s->dma_addr, addr == IRQ_STORM_REG_DMA_ADDR_LO ? 0 : 32,
+                                      32, val);
+        if (dma_addr != s->dma_addr) {
+            s->dma_addr = dma_addr;
+            s->dma_pos = 0;
+            s->config_writes++;
+        }
+        break;
+    }
+    case IRQ_STORM_REG_DMA_LEN:
+        if ((uint32_t)val != s->dma_len) {
+            s->dma_len = val;
+            s->dma_pos = 0;
+            s->config_writes++;
+            irq_storm_dma_update(s);
+        }
+        break;
+    case IRQ_STORM_REG_DMA_BW_MIBS:
+        val = MIN((uint32_t)val, IRQ_STORM_MAX_DMA_BW);
+        if (val != s->dma_bw_mibs) {
+            s->dma_bw_mibs = val;
+            s->config_writes++;
+            irq_storm_dma_update(s);
+        }
+        break;
+    case IRQ_STORM_REG_DATA_LEN:
+        val = MIN((uint32_t)val, IRQ_STORM_MAX_DATA_LEN);
+        if (val != s->data_len) {
+            s->data_len = val;
+            s->data_valid = false;
+            s->config_writes++;
+        }
+        break;
     default:
         break;
     }
@@ -255,13 +575,20 @@ static void irq_storm_realize(DeviceState *dev, Error **errp)
         error_setg(errp, "isa-irq-storm: irq must be in range [0..15]");
         return;
     }
-    if (s->iosize < 0x20) {
-        error_setg(errp, "isa-irq-storm: iosize must be at least 0x20");
+    if (s->iosize < IRQ_STORM_REG_END) {
+        error_setg(errp, "isa-irq-storm: iosize must be at least 0x%x",
+                   IRQ_STORM_REG_END);
+        return;
+    }
+    if (s->data_len > IRQ_STORM_MAX_DATA_LEN) {
+        error_setg(errp, "isa-irq-storm: data-len must be at most %u",
+                   IRQ_STORM_MAX_DATA_LEN);
         return;
     }
 
     s->irq = isa_get_irq(isadev, s->isairq);
     s->timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, irq_storm_timer_cb, s);
+    s->dma_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, irq_storm_dma_tick, s);
 
     memory_region_init_io(&s->io, OBJECT(dev), &irq_storm_ops, s,
                           TYPE_ISA_IRQ_STORM_DEVICE, s->iosize);
@@ -285,14 +612,20 @@ static void irq_storm_unrealize(DeviceState *dev)
         timer_free(s->timer);
         s->timer = NULL;
     }
+    if (s->dma_timer) {
+        timer_del(s->dma_timer);
+        timer_free(s->dma_timer);
+        s->dma_timer = NULL;
+    }
 }
 
 static const Property irq_storm_properties[] = {
     DEFINE_PROP_UINT32("iobase", ISAIrqStormState, iobase, 0x560),
-    DEFINE_PROP_UINT32("iosize", ISAIrqStormState, iosize, 0x20),
+    DEFINE_PROP_UINT32("iosize", ISAIrqStormState, iosize, 0x80),
     DEFINE_PROP_UINT32("irq", ISAIrqStormState, isairq, 5),
     DEFINE_PROP_UINT32("burst", ISAIrqStormState, burst, 128),
     DEFINE_PROP_UINT32("period-us", ISAIrqStormState, period_us, 100),
+    DEFINE_PROP_UINT32("data-len", ISAIrqStormState, data_len, 0),
     DEFINE_PROP_BOOL("start-enabled", ISAIrqStormState, start_enabled, true),
     DEFINE_PROP_BOOL("level-triggered", ISAIrqStormState, level_triggered,
                      false),
@@ -0,0 +1,546 @@
+/*
+ * Linux guest driver for the QEMU isa-irq-storm device.
+ *
+ * Mirrors the seL4 root task handler (sel4_irq_handle.c): read STATUS, ACK
+ * the device in level mode, count, and print the same "storm:"/"hist:"
+ * report lines so one QEMU configuration can be compared across kernels.
+ *
+ * Variants (module parameter "variant"):
+ *   hardirq   - all work in the hard IRQ handler
+ *   threaded  - IRQF_ONESHOT threaded handler; the primary only timestamps
+ *   napi      - hard IRQ masks the line and schedules a NAPI poll that
+ *               services pending device events under a budget
+ *
+ * "handled" counts handler wake-ups (one per IRQ, or per NAPI poll), the
+ * unit the seL4 handler counts per notification. "serviced" counts device
+ * events; it only differs from handled in the napi variant, which services
+ * up to one event per pulse in each poll.
+ *
+ * Build: make -C /lib/modules/$(uname -r)/build M=$PWD obj-m=irq_storm_linux.o
+ * Load:  insmod irq_storm_linux.ko variant=threaded
+ *
+ * debugfs (isa-irq-storm/): report (last report line), hist, handled,
+ * reset (write anything).
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/interrupt.h>
+#include <linux/ioport.h>
+#include <linux/io.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/workqueue.h>
+#include <linux/netdevice.h>
+#include <linux/slab.h>
+#include <linux/timex.h>
+#include <linux/version.h>
+#include <asm/tsc.h>
+
+/* IRQ storm device layout */
+
+#define STORM_IOSIZE     0x20
+
+#define REG_CTRL         0x00
+#define REG_IRQ          0x01
+#define REG_BURST        0x02
+#define REG_STATUS       0x03
+#define REG_PERIOD_US    0x04
+
+#define REG_PULSES_LO    0x08
+#define REG_PULSES_HI    0x0C
+#define REG_TIMER_CB     0x10
+#define REG_CFG_WRITES   0x14
+#define REG_EN_TOGGLES   0x18
+#define REG_ACK          0x1C
+
+#define CTRL_ENABLE      (1u << 0)
+#define CTRL_LEVEL       (1u << 1)
+
+#define STATUS_ENABLED   (1u << 0)
+#define STATUS_ASSERT    (1u << 1)
+#define STATUS_LEVEL     (1u << 2)
+
+#define HIST_BUCKETS     64
+#define REPORT_LINE_MAX  320
+
+static unsigned int iobase = 0x560;
+module_param(iobase, uint, 0444);
+MODULE_PARM_DESC(iobase, "I/O base of isa-irq-storm");
+
+static unsigned int irq = 5;
+module_param(irq, uint, 0444);
+MODULE_PARM_DESC(irq, "ISA IRQ of isa-irq-storm");
+
+static char *variant = "hardirq";
+module_param(variant, charp, 0444);
+MODULE_PARM_DESC(variant, "hardirq | threaded | napi");
+
+static unsigned long report_every = 1UL << 16;
+module_param(report_every, ulong, 0644);
+MODULE_PARM_DESC(report_every, "report every N handler wake-ups");
+
+static unsigned int napi_budget = 64;
+module_param(napi_budget, uint, 0444);
+MODULE_PARM_DESC(napi_budget, "NAPI weight: events serviced per poll (napi variant)");
+
+enum storm_variant {
+    STORM_HARDIRQ,
+    STORM_THREADED,
+    STORM_NAPI,
+};
+
+struct storm {
+    enum storm_variant variant;
+    unsigned long iobase;
+
+    /* Written from the IRQ path only (reset quiesces it first) */
+    u64 handled;
+    u64 serviced;
+    u64 irqs;
+    u64 polls;
+    u64 cycles_total;
+    u64 hist_cycles[HIST_BUCKETS];
+    u64 hist_wake[HIST_BUCKETS];  /* threaded: primary -> thread; napi: IRQ -> poll */
+    u64 wake_tsc;
+    u32 serviced_pulses;          /* napi: low 32 bits of pulses already serviced */
+    bool irq_masked;              /* napi: the hard IRQ disabled the line for the poll */
+    u8 last_status;
+    u64 report_queued;
+
+    /* Owned by the report work item */
+    struct work_struct report_work;
+    bool reset_pending;
+    u64 report_base;
+    u64 last_tsc;
+    u64 last_pulses;
+    u32 last_timer_cb;
+    u32 last_cfg_writes;
+    u32 last_en_toggles;
+    char line[REPORT_LINE_MAX];
+
+    struct net_device *napi_dev;
+    struct napi_struct napi;
+    struct dentry *dbg;
+};
+
+static struct storm storm;
+
+static inline void hist_add(u64 *hist, u64 v)
+{
+    hist[63 - __builtin_clzll(v | 1)]++;
+}
+
+static u64 read_u64_lohi_stable(struct storm *s, unsigned int lo_reg, unsigned int hi_reg)
+{
+    u32 hi1, hi2, lo;
+
+    do {
+        hi1 = inl(s->iobase + hi_reg);
+        lo  = inl(s->iobase + lo_reg);
+        hi2 = inl(s->iobase + hi_reg);
+    } while (hi1 != hi2);
+    return ((u64)hi2 << 32) | lo;
+}
+
+/* Same per-event work as the seL4 handler: status read, ACK if level-asserted */
+static inline void storm_service_one(struct storm *s)
+{
+    u8 status = inb(s->iobase + REG_STATUS);
+
+    s->last_status = status;
+    if ((status & STATUS_LEVEL) && (status & STATUS_ASSERT)) {
+        outl(1, s->iobase + REG_ACK);
+    }
+    s->serviced++;
+}
+
+static inline void storm_maybe_report(struct storm *s)
+{
+    if (s->handled - s->report_queued >= READ_ONCE(report_every)) {
+        s->report_queued = s->handled;
+        schedule_work(&s->report_work);
+    }
+}
+
+static void storm_rebase(struct storm *s)
+{
+    s->last_tsc = get_cycles();
+    s->last_pulses = read_u64_lohi_stable(s, REG_PULSES_LO, REG_PULSES_HI);
+    s->last_timer_cb = inl(s->iobase + REG_TIMER_CB);
+    s->last_cfg_writes = inl(s->iobase + REG_CFG_WRITES);
+    s->last_en_toggles = inl(s->iobase + REG_EN_TOGGLES);
+}
+
+static void storm_report_work(struct work_struct *work)
+{
+    struct storm *s = container_of(work, struct storm, report_work);
+    u64 handled = READ_ONCE(s->handled);
+    u64 tsc, pulses;
+    u32 timer_cb, cfg_writes, en_toggles, cur_burst, cur_period;
+    u8 cur_ctrl;
+
+    if (READ_ONCE(s->reset_pending)) {
+        WRITE_ONCE(s->reset_pending, false);
+        /*
+         * The counters belong to the IRQ path. Quiesce it (disable_irq() also
+         * waits for a running threaded handler) and any NAPI poll so the
+         * reset is neither torn nor immediately re-queues a report.
+         */
+        disable_irq(irq);
+        if (s->variant == STORM_NAPI) {
+            napi_disable(&s->napi);
+            /*
+             * A full-budget poll that napi_disable() completed itself never
+             * re-enabled the line the hard IRQ masked; balance it here.
+             */
+            if (s->irq_masked) {
+                s->irq_masked = false;
+                enable_irq(irq);
+            }
+        }
+        s->handled = 0;
+        s->serviced = 0;
+        s->irqs = 0;
+        s->polls = 0;
+        s->cycles_total = 0;
+        s->report_queued = 0;
+        s->report_base = 0;
+        memset(s->hist_cycles, 0, sizeof(s->hist_cycles));
+        memset(s->hist_wake, 0, sizeof(s->hist_wake));
+        storm_rebase(s);
+        if (s->variant == STORM_NAPI) {
+            napi_enable(&s->napi);
+        }
+        enable_irq(irq);
+        return;
+    }
+
+    tsc = get_cycles();
+    pulses = read_u64_lohi_stable(s, REG_PULSES_LO, REG_PULSES_HI);
+    timer_cb = inl(s->iobase + REG_TIMER_CB);
+    cfg_writes = inl(s->iobase + REG_CFG_WRITES);
+    en_toggles = inl(s->iobase + REG_EN_TOGGLES);
+
+    cur_ctrl = inb(s->iobase + REG_CTRL);
+    cur_burst = inb(s->iobase + REG_BURST);
+    cur_period = inl(s->iobase + REG_PERIOD_US);
+
+    /* badge has no Linux equivalent; report the IRQ number in its place */
+    snprintf(s->line, sizeof(s->line),
+             "storm: handled=%llu (+%llu) dpulses=%llu dtimer_cb=%u dcfg=%u dtog=%u ctrl=0x%02x status=0x%02x badge=0x%x burst=%u period-us=%u total_pulses=%llu dtsc=%llu irqs=%llu polls=%llu serviced=%llu",
+             handled,
+             handled - s->report_base,
+             pulses - s->last_pulses,
+             timer_cb - s->last_timer_cb,
+             cfg_writes - s->last_cfg_writes,
+             en_toggles - s->last_en_toggles,
+             (unsigned int)cur_ctrl,
+             (unsigned int)READ_ONCE(s->last_status),
+             irq,
+             cur_burst,
+             cur_period,
+             pulses,
+             tsc - s->last_tsc,
+             READ_ONCE(s->irqs),
+             READ_ONCE(s->polls),
+             READ_ONCE(s->serviced));
+    pr_info("%s\n", s->line);
+
+    s->report_base = handled;
+    s->last_tsc = tsc;
+    s->last_pulses = pulses;
+    s->last_timer_cb = timer_cb;
+    s->last_cfg_writes = cfg_writes;
+    s->last_en_toggles = en_toggles;
+}
+
+/* hardirq variant */
+
+static irqreturn_t storm_hardirq(int irqno, void *dev_id)
+{
+    struct storm *s = dev_id;
+    cycles_t t0 = get_cycles();
+    u64 cycles;
+
+    s->irqs++;
+    s->handled++;
+    storm_service_one(s);
+
+    cycles = get_cycles() - t0;
+    s->cycles_total += cycles;
+    hist_add(s->hist_cycles, cycles);
+    storm_maybe_report(s);
+    return IRQ_HANDLED;
+}
+
+/* threaded variant */
+
+static irqreturn_t storm_threaded_primary(int irqno, void *dev_id)
+{
+    struct storm *s = dev_id;
+
+    s->wake_tsc = get_cycles();
+    s->irqs++;
+    return IRQ_WAKE_THREAD;
+}
+
+static irqreturn_t storm_threaded_fn(int irqno, void *dev_id)
+{
+    struct storm *s = dev_id;
+    cycles_t t0 = get_cycles();
+    u64 cycles;
+
+    hist_add(s->hist_wake, t0 - s->wake_tsc);
+    s->handled++;
+    storm_service_one(s);
+
+    cycles = get_cycles() - t0;
+    s->cycles_total += cycles;
+    hist_add(s->hist_cycles, cycles);
+    storm_maybe_report(s);
+    return IRQ_HANDLED;
+}
+
+/* napi variant */
+
+static irqreturn_t storm_napi_irq(int irqno, void *dev_id)
+{
+    struct storm *s = dev_id;
+
+    s->irqs++;
+    s->wake_tsc = get_cycles();
+    s->irq_masked = true;
+    disable_irq_nosync(irqno);
+    napi_schedule(&s->napi);
+    return IRQ_HANDLED;
+}
+
+static int storm_napi_poll(struct napi_struct *napi, int budget)
+{
+    struct storm *s = container_of(napi, struct storm, napi);
+    cycles_t t0 = get_cycles();
+    u64 cycles;
+    u32 pending;
+    int done = 0;
+
+    if (!budget) {
+        return 0;
+    }
+    /* Only the first poll after an IRQ measures wake-up; re-polls have no IRQ */
+    if (s->wake_tsc) {
+        hist_add(s->hist_wake, t0 - s->wake_tsc);
+        s->wake_tsc = 0;
+    }
+    s->polls++;
+    s->handled++;
+
+    /* Pending work: device pulses not yet serviced (one event per pulse) */
+    pending = inl(s->iobase + REG_PULSES_LO) - s->serviced_pulses;
+
+    while (pending && done < budget) {
+        storm_service_one(s);
+        s->serviced_pulses++;
+        pending--;
+        done++;
+    }
+    /* A level interrupt can be asserted with no new pulse; still drain it */
+    if (!done) {
+        storm_service_one(s);
+        done = 1;
+    }
+
+    cycles = get_cycles() - t0;
+    s->cycles_total += cycles;
+    hist_add(s->hist_cycles, cycles);
+    storm_maybe_report(s);
+
+    if (done < budget && napi_complete_done(napi, done)) {
+        s->irq_masked = false;
+        enable_irq(irq);
+    }
+    return done;
+}
+
+static int storm_napi_setup(struct storm *s)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 10, 0)
+    s->napi_dev = alloc_netdev_dummy(0);
+    if (!s->napi_dev) {
+        return -ENOMEM;
+    }
+#else
+    s->napi_dev = kzalloc(sizeof(*s->napi_dev), GFP_KERNEL);
+    if (!s->napi_dev) {
+        return -ENOMEM;
+    }
+    init_dummy_netdev(s->napi_dev);
+#endif
+    /* The core hands the weight back as the poll budget and expects completion below it */
+    netif_napi_add_weight(s->napi_dev, &s->napi, storm_napi_poll, napi_budget);
+    napi_enable(&s->napi);
+    s->serviced_pulses = inl(s->iobase + REG_PULSES_LO);
+    return 0;
+}
+
+static void storm_napi_teardown(struct storm *s)
+{
+    if (!s->napi_dev) {
+        return;
+    }
+    napi_disable(&s->napi);
+    netif_napi_del(&s->napi);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 10, 0)
+    free_netdev(s->napi_dev);
+#else
+    kfree(s->napi_dev);
+#endif
+    s->napi_dev = NULL;
+}
+
+/* debugfs */
+
+static int storm_report_show(struct seq_file *m, void *unused)
+{
+    struct storm *s = m->private;
+
+    seq_printf(m, "%s\n", s->line);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(storm_report);
+
+static void hist_show(struct seq_file *m, const char *name, const u64 *hist)
+{
+    u64 total = 0;
+    int i;
+
+    for (i = 0; i < HIST_BUCKETS; i++) {
+        total += hist[i];
+    }
+    seq_printf(m, "hist: %s total=%llu\n", name, total);
+    for (i = 0; i < HIST_BUCKETS; i++) {
+        if (hist[i]) {
+            seq_printf(m, "hist: %s 2^%d %llu\n", name, i, hist[i]);
+        }
+    }
+}
+
+static int storm_hist_show(struct seq_file *m, void *unused)
+{
+    struct storm *s = m->private;
+
+    hist_show(m, "handler-cycles", s->hist_cycles);
+    if (s->variant != STORM_HARDIRQ) {
+        hist_show(m, "wake-cycles", s->hist_wake);
+    }
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(storm_hist);
+
+static ssize_t storm_reset_write(struct file *file, const char __user *buf,
+                                 size_t len, loff_t *ppos)
+{
+    struct storm *s = file->private_data;
+
+    WRITE_ONCE(s->reset_pending, true);
+    schedule_work(&s->report_work);
+    return len;
+}
+
+static const struct file_operations storm_reset_fops = {
+    .owner = THIS_MODULE,
+    .open = simple_open,
+    .write = storm_reset_write,
+    .llseek = noop_llseek,
+};
+
+static int __init storm_init(void)
+{
+    struct storm *s = &storm;
+    int err;
+    u8 ctrl;
+
+    if (!strcmp(variant, "hardirq")) {
+        s->variant = STORM_HARDIRQ;
+    } else if (!strcmp(variant, "threaded")) {
+        s->variant = STORM_THREADED;
+    } else if (!strcmp(variant, "napi")) {
+        s->variant = STORM_NAPI;
+    } else {
+        pr_err("isa-irq-storm: unknown variant '%s'\n", variant);
+        return -EINVAL;
+    }
+    if (!report_every || !napi_budget) {
+        return -EINVAL;
+    }
+
+    s->iobase = iobase;
+    if (!request_region(s->iobase, STORM_IOSIZE, "isa-irq-storm")) {
+        return -EBUSY;
+    }
+
+    INIT_WORK(&s->report_work, storm_report_work);
+    storm_rebase(s);
+    s->last_status = inb(s->iobase + REG_STATUS);
+
+    pr_info("isa-irq-storm: variant=%s device reports IRQ line: %u\n",
+            variant, (unsigned int)inb(s->iobase + REG_IRQ));
+    pr_info("env: guest=linux variant=%s tsc-mhz=%u\n", variant, tsc_khz / 1000);
+
+    switch (s->variant) {
+    case STORM_HARDIRQ:
+        err = request_irq(irq, storm_hardirq, 0, "isa-irq-storm", s);
+        break;
+    case STORM_THREADED:
+        err = request_threaded_irq(irq, storm_threaded_primary, storm_threaded_fn,
+                                   IRQF_ONESHOT, "isa-irq-storm", s);
+        break;
+    case STORM_NAPI:
+        err = storm_napi_setup(s);
+        if (!err) {
+            err = request_irq(irq, storm_napi_irq, 0, "isa-irq-storm", s);
+        }
+        break;
+    default:
+        err = -EINVAL;
+        break;
+    }
+    if (err) {
+        storm_napi_teardown(s);
+        release_region(s->iobase, STORM_IOSIZE);
+        return err;
+    }
+
+    s->dbg = debugfs_create_dir("isa-irq-storm", NULL);
+    debugfs_create_file("report", 0444, s->dbg, s, &storm_report_fops);
+    debugfs_create_file("hist", 0444, s->dbg, s, &storm_hist_fops);
+    debugfs_create_file("reset", 0200, s->dbg, s, &storm_reset_fops);
+    debugfs_create_u64("handled", 0444, s->dbg, &s->handled);
+
+    /* Ensure enabled (do not change LEVEL bit set by QEMU) */
+    ctrl = inb(s->iobase + REG_CTRL);
+    if (!(ctrl & CTRL_ENABLE)) {
+        outb(ctrl | CTRL_ENABLE, s->iobase + REG_CTRL);
+    }
+    return 0;
+}
+
+static void __exit storm_exit(void)
+{
+    struct storm *s = &storm;
+
+    outb(inb(s->iobase + REG_CTRL) & ~CTRL_ENABLE, s->iobase + REG_CTRL);
+    debugfs_remove_recursive(s->dbg);
+    /* A queued reset touches the IRQ and NAPI; finish it while both still exist */
+    cancel_work_sync(&s->report_work);
+    free_irq(irq, s);
+    storm_napi_teardown(s);
+    cancel_work_sync(&s->report_work);
+    release_region(s->iobase, STORM_IOSIZE);
+}
+
+module_init(storm_init);
+module_exit(storm_exit);
+
+MODULE_DESCRIPTION("isa-irq-storm guest driver (cross-OS baseline for the seL4 handler)");
+MODULE_LICENSE("GPL");
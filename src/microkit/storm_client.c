@@ -0,0 +1,132 @@
+/*
+ * Microkit client PD for isa-irq-storm.
+ *
+ * Drains the driver's event ring on each batched notification and measures
+ * what the framework adds on top of the bare root task:
+ *   delivery   driver IRQ entry -> event consumed here (histogram)
+ *   batch      events drained per notified() entry
+ *   ppc        cycles for one protected call into the driver
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <microkit.h>
+
+#include "storm_common.h"
+
+#define REPORT_EVERY     (1ULL << 16)
+
+uintptr_t ring_vaddr;
+
+static storm_ring_t *ring;
+
+static struct {
+    uint64_t consumed;
+    uint64_t notified;
+    uint64_t seq_gaps;
+    uint64_t next_seq;
+    uint64_t hist_delivery[HIST_BUCKETS];
+
+    uint64_t report_base;
+    uint64_t last_notified;
+    uint64_t last_tsc;
+} st;
+
+static void client_report(void)
+{
+    uint64_t tsc = rdtsc();
+
+    uint64_t t0 = rdtsc();
+    microkit_msginfo info = microkit_ppcall(CLIENT_CH_DRIVER,
+                                            microkit_msginfo_new(STORM_PPC_COUNTERS, 0));
+    uint64_t ppc_cycles = rdtsc() - t0;
+
+    uint64_t drv_handled = 0, drv_pulses = 0, drv_notifies = 0;
+    if (microkit_msginfo_get_label(info) == STORM_PPC_COUNTERS) {
+        drv_handled = microkit_mr_get(0);
+        drv_pulses = microkit_mr_get(1);
+        drv_notifies = microkit_mr_get(2);
+    }
+
+    uint64_t dconsumed = st.consumed - st.report_base;
+    uint64_t dnotified = st.notified - st.last_notified;
+    line_t l = { .len = 0 };
+
+    line_str(&l, "client: consumed=");
+    line_u64(&l, st.consumed);
+    line_str(&l, " (+");
+    line_u64(&l, dconsumed);
+    line_str(&l, ")");
+    line_kv(&l, "notified", st.notified);
+    line_kv(&l, "batch", dnotified ? dconsumed / dnotified : 0);
+    line_kv(&l, "seq_gaps", st.seq_gaps);
+    line_kv(&l, "dropped", ring->dropped);
+    line_kv(&l, "ppc-cycles", ppc_cycles);
+    line_kv(&l, "drv_handled", drv_handled);
+    line_kv(&l, "drv_notifies", drv_notifies);
+    line_kv(&l, "total_pulses", drv_pulses);
+    line_kv(&l, "dtsc", tsc - st.last_tsc);
+    line_emit(&l);
+
+    st.report_base = st.consumed;
+    st.last_notified = st.notified;
+    st.last_tsc = tsc;
+
+    if ((st.consumed / REPORT_EVERY) % 16 == 0) {
+        print_hist("delivery-cycles", st.hist_delivery);
+    }
+}
+
+static void ring_drain(void)
+{
+    uint32_t tail = ring->tail;
+
+    for (;;) {
+        uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        if (tail == head) {
+            /* Ask for an immediate notification, then recheck to close the race */
+            __atomic_store_n(&ring->client_waiting, 1, __ATOMIC_SEQ_CST);
+            if (__atomic_load_n(&ring->head, __ATOMIC_SEQ_CST) == tail) {
+                break;
+            }
+            __atomic_store_n(&ring->client_waiting, 0, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        uint64_t now = rdtsc();
+        while (tail != head) {
+            storm_event_t *ev = &ring->ev[tail & (STORM_RING_SLOTS - 1)];
+            if (ev->seq != st.next_seq) {
+                st.seq_gaps++;
+            }
+            st.next_seq = ev->seq + 1;
+            hist_add(st.hist_delivery, now - ev->tsc);
+            st.consumed++;
+            tail++;
+        }
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+
+        if (st.consumed - st.report_base >= REPORT_EVERY) {
+            client_report();
+        }
+    }
+}
+
+void init(void)
+{
+    ring = (storm_ring_t *)ring_vaddr;
+    st.next_seq = 1;
+    st.last_tsc = rdtsc();
+    ring->client_waiting = 1;
+    microkit_dbg_puts("storm_client: waiting for events\n");
+}
+
+void notified(microkit_channel ch)
+{
+    if (ch != CLIENT_CH_DRIVER) {
+        return;
+    }
+    st.notified++;
+    ring_drain();
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <microkit.h>
+
+/* Shared between storm_driver and storm_client */
+
+#define STORM_RING_SLOTS   1024u /* power of two */
+
+#define DRIVER_CH_IRQ      0
+#define DRIVER_CH_CLIENT   1
+#define CLIENT_CH_DRIVER   1
+
+/* PPC labels served by storm_driver's protected() */
+#define STORM_PPC_COUNTERS 1     /* -> MR0 handled, MR1 pulses, MR2 notifies */
+
+#define HIST_BUCKETS       64
+
+typedef struct {
+    uint64_t seq;
+    uint64_t tsc;                /* driver-side timestamp at IRQ entry */
+    uint8_t status;
+} storm_event_t;
+
+typedef struct {
+    volatile uint32_t head;      /* written by driver */
+    volatile uint32_t tail;      /* written by client */
+    volatile uint32_t client_waiting; /* client drained the ring and sleeps */
+    volatile uint32_t dropped;
+    storm_event_t ev[STORM_RING_SLOTS];
+} storm_ring_t;
+
+static inline uint64_t rdtsc(void)
+{
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void hist_add(uint64_t *hist, uint64_t v)
+{
+    hist[63 - __builtin_clzll(v | 1)]++;
+}
+
+/* Minimal line formatting: Microkit PDs only have microkit_dbg_puts */
+
+typedef struct {
+    char buf[320];
+    unsigned len;
+} line_t;
+
+static inline void line_str(line_t *l, const char *s)
+{
+    while (*s && l->len < sizeof(l->buf) - 1) {
+        l->buf[l->len++] = *s++;
+    }
+    l->buf[l->len] = '\0';
+}
+
+static inline void line_u64(line_t *l, uint64_t v)
+{
+    char tmp[21];
+    int i = sizeof(tmp) - 1;
+    tmp[i] = '\0';
+    do {
+        tmp[--i] = (char)('0' + v % 10);
+        v /= 10;
+    } while (v);
+    line_str(l, &tmp[i]);
+}
+
+static inline void line_hex(line_t *l, uint64_t v, int min_digits)
+{
+    char tmp[17];
+    int i = sizeof(tmp) - 1;
+    tmp[i] = '\0';
+    do {
+        tmp[--i] = "0123456789abcdef"[v & 0xf];
+        v >>= 4;
+        min_digits--;
+    } while (v || min_digits > 0);
+    line_str(l, "0x");
+    line_str(l, &tmp[i]);
+}
+
+static inline void line_kv(line_t *l, const char *key, uint64_t v)
+{
+    line_str(l, " ");
+    line_str(l, key);
+    line_str(l, "=");
+    line_u64(l, v);
+}
+
+static inline void line_emit(line_t *l)
+{
+    line_str(l, "\n");
+    microkit_dbg_puts(l->buf);
+    l->len = 0;
+    l->buf[0] = '\0';
+}
+
+static inline void print_hist(const char *name, const uint64_t *hist)
+{
+    line_t l = { .len = 0 };
+    uint64_t total = 0;
+
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        total += hist[i];
+    }
+    line_str(&l, "hist: ");
+    line_str(&l, name);
+    line_kv(&l, "total", total);
+    line_emit(&l);
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        if (hist[i]) {
+            line_str(&l, "hist: ");
+            line_str(&l, name);
+            line_str(&l, " 2^");
+            line_u64(&l, (uint64_t)i);
+            line_str(&l, " ");
+            line_u64(&l, hist[i]);
+            line_emit(&l);
+        }
+    }
+}
@@ -0,0 +1,262 @@
+/*
+ * Microkit driver PD for isa-irq-storm.
+ *
+ * Same per-IRQ work as the bare root task (status read, ACK in level mode,
+ * IRQ ack) plus one event pushed to the shared ring. The client is notified
+ * once per `notify_batch` events, or immediately if it is waiting on an
+ * empty ring, so a stopped storm never strands events.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <microkit.h>
+
+#include "storm_common.h"
+
+/* IRQ storm device layout (ports relative to the ioport region) */
+
+#define STORM_IOBASE     0x560
+
+#define REG_CTRL         (STORM_IOBASE + 0x00)
+#define REG_BURST        (STORM_IOBASE + 0x02)
+#define REG_STATUS       (STORM_IOBASE + 0x03)
+#define REG_PERIOD_US    (STORM_IOBASE + 0x04)
+
+#define REG_PULSES_LO    (STORM_IOBASE + 0x08)
+#define REG_PULSES_HI    (STORM_IOBASE + 0x0C)
+#define REG_TIMER_CB     (STORM_IOBASE + 0x10)
+#define REG_CFG_WRITES   (STORM_IOBASE + 0x14)
+#define REG_EN_TOGGLES   (STORM_IOBASE + 0x18)
+#define REG_ACK          (STORM_IOBASE + 0x1C)
+
+#define CTRL_ENABLE      (1u << 0)
+
+#define STATUS_ASSERT    (1u << 1)
+#define STATUS_LEVEL     (1u << 2)
+
+#define STORM_IOPORT     0
+
+/*
+ * Microkit PDs get no bootinfo, so the TSC rate the root task reads from the
+ * x86 TSC-frequency header is calibrated here against PIT channel 2 instead,
+ * the same way the kernel measures it at boot.
+ */
+#define PIT_IOPORT       1
+#define PIT_CH2          0x42
+#define PIT_MODE         0x43
+#define PIT_GATE_IOPORT  2
+#define PIT_GATE         0x61
+#define PIT_GATE_CH2     (1u << 0)
+#define PIT_GATE_SPEAKER (1u << 1)
+#define PIT_GATE_OUT2    (1u << 5)
+#define PIT_MODE_CH2_ONESHOT 0xB0 /* channel 2, lo/hi byte, mode 0, binary */
+#define PIT_HZ           1193182
+#define PIT_CAL_MS       10
+
+/* Tunables */
+#define REPORT_EVERY     (1ULL << 16)
+#define NOTIFY_BATCH     32
+
+uintptr_t ring_vaddr;
+
+static storm_ring_t *ring;
+
+static struct {
+    uint64_t handled;
+    uint64_t notifies;
+    uint64_t cycles_total;
+    uint64_t hist_cycles[HIST_BUCKETS];
+    uint32_t unnotified;
+    uint8_t last_status;
+
+    uint64_t report_base;
+    uint64_t last_tsc;
+    uint64_t last_pulses;
+    uint32_t last_timer_cb;
+    uint32_t last_cfg_writes;
+    uint32_t last_en_toggles;
+} st;
+
+static inline uint8_t io_in8(uint16_t port)
+{
+    return (uint8_t)microkit_x86_ioport_read_8(STORM_IOPORT, port);
+}
+
+static inline uint32_t io_in32(uint16_t port)
+{
+    return (uint32_t)microkit_x86_ioport_read_32(STORM_IOPORT, port);
+}
+
+static inline void io_out8(uint16_t port, uint8_t val)
+{
+    microkit_x86_ioport_write_8(STORM_IOPORT, port, val);
+}
+
+static inline void io_out32(uint16_t port, uint32_t val)
+{
+    microkit_x86_ioport_write_32(STORM_IOPORT, port, val);
+}
+
+static uint64_t read_u64_lohi_stable(uint16_t lo_port, uint16_t hi_port)
+{
+    uint32_t hi1, hi2, lo;
+    do {
+        hi1 = io_in32(hi_port);
+        lo  = io_in32(lo_port);
+        hi2 = io_in32(hi_port);
+    } while (hi1 != hi2);
+    return ((uint64_t)hi2 << 32) | lo;
+}
+
+static void storm_report(void)
+{
+    uint64_t tsc = rdtsc();
+    uint64_t pulses = read_u64_lohi_stable(REG_PULSES_LO, REG_PULSES_HI);
+    uint32_t timer_cb = io_in32(REG_TIMER_CB);
+    uint32_t cfg_writes = io_in32(REG_CFG_WRITES);
+    uint32_t en_toggles = io_in32(REG_EN_TOGGLES);
+    line_t l = { .len = 0 };
+
+    line_str(&l, "storm: handled=");
+    line_u64(&l, st.handled);
+    line_str(&l, " (+");
+    line_u64(&l, st.handled - st.report_base);
+    line_str(&l, ")");
+    line_kv(&l, "dpulses", pulses - st.last_pulses);
+    line_kv(&l, "dtimer_cb", (uint32_t)(timer_cb - st.last_timer_cb));
+    line_kv(&l, "dcfg", (uint32_t)(cfg_writes - st.last_cfg_writes));
+    line_kv(&l, "dtog", (uint32_t)(en_toggles - st.last_en_toggles));
+    line_str(&l, " ctrl=");
+    line_hex(&l, io_in8(REG_CTRL), 2);
+    line_str(&l, " status=");
+    line_hex(&l, st.last_status, 2);
+    line_str(&l, " badge=");
+    line_hex(&l, 1ULL << DRIVER_CH_IRQ, 1);
+    line_kv(&l, "burst", io_in8(REG_BURST));
+    line_kv(&l, "period-us", io_in32(REG_PERIOD_US));
+    line_kv(&l, "total_pulses", pulses);
+    line_kv(&l, "dtsc", tsc - st.last_tsc);
+    line_kv(&l, "notifies", st.notifies);
+    line_kv(&l, "dropped", ring->dropped);
+    line_emit(&l);
+
+    st.report_base = st.handled;
+    st.last_tsc = tsc;
+    st.last_pulses = pulses;
+    st.last_timer_cb = timer_cb;
+    st.last_cfg_writes = cfg_writes;
+    st.last_en_toggles = en_toggles;
+
+    if ((st.handled / REPORT_EVERY) % 16 == 0) {
+        print_hist("handler-cycles", st.hist_cycles);
+    }
+}
+
+static void ring_push(uint8_t status, uint64_t tsc)
+{
+    uint32_t head = ring->head;
+
+    if (head - ring->tail >= STORM_RING_SLOTS) {
+        ring->dropped++;
+        return;
+    }
+    storm_event_t *ev = &ring->ev[head & (STORM_RING_SLOTS - 1)];
+    ev->seq = st.handled;
+    ev->tsc = tsc;
+    ev->status = status;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+
+    if (++st.unnotified >= NOTIFY_BATCH ||
+        __atomic_exchange_n(&ring->client_waiting, 0, __ATOMIC_ACQ_REL)) {
+        st.unnotified = 0;
+        st.notifies++;
+        microkit_notify(DRIVER_CH_CLIENT);
+    }
+}
+
+static uint32_t tsc_calibrate_mhz(void)
+{
+    uint16_t ticks = PIT_HZ * PIT_CAL_MS / 1000;
+    uint8_t gate = (uint8_t)microkit_x86_ioport_read_8(PIT_GATE_IOPORT, PIT_GATE);
+
+    /* Gate low while loading, speaker off; OUT2 goes high at terminal count */
+    microkit_x86_ioport_write_8(PIT_GATE_IOPORT, PIT_GATE,
+                                gate & ~(PIT_GATE_CH2 | PIT_GATE_SPEAKER));
+    microkit_x86_ioport_write_8(PIT_IOPORT, PIT_MODE, PIT_MODE_CH2_ONESHOT);
+    microkit_x86_ioport_write_8(PIT_IOPORT, PIT_CH2, ticks & 0xff);
+    microkit_x86_ioport_write_8(PIT_IOPORT, PIT_CH2, ticks >> 8);
+
+    microkit_x86_ioport_write_8(PIT_GATE_IOPORT, PIT_GATE,
+                                (gate & ~PIT_GATE_SPEAKER) | PIT_GATE_CH2);
+    uint64_t t0 = rdtsc();
+    while (!(microkit_x86_ioport_read_8(PIT_GATE_IOPORT, PIT_GATE) & PIT_GATE_OUT2)) {
+    }
+    uint64_t cycles = rdtsc() - t0;
+
+    microkit_x86_ioport_write_8(PIT_GATE_IOPORT, PIT_GATE, gate);
+    return (uint32_t)(cycles / (PIT_CAL_MS * 1000));
+}
+
+void init(void)
+{
+    ring = (storm_ring_t *)ring_vaddr;
+    uint32_t tsc_mhz = tsc_calibrate_mhz();
+
+    st.last_tsc = rdtsc();
+    st.last_pulses = read_u64_lohi_stable(REG_PULSES_LO, REG_PULSES_HI);
+    st.last_timer_cb = io_in32(REG_TIMER_CB);
+    st.last_cfg_writes = io_in32(REG_CFG_WRITES);
+    st.last_en_toggles = io_in32(REG_EN_TOGGLES);
+    st.last_status = io_in8(REG_STATUS);
+
+    microkit_dbg_puts("storm_driver: isa-irq-storm on Microkit\n");
+    line_t l = { .len = 0 };
+    line_str(&l, "env: guest=microkit");
+    line_kv(&l, "tsc-mhz", tsc_mhz);
+    line_emit(&l);
+
+    uint8_t ctrl = io_in8(REG_CTRL);
+    if (!(ctrl & CTRL_ENABLE)) {
+        io_out8(REG_CTRL, ctrl | CTRL_ENABLE);
+    }
+    microkit_irq_ack(DRIVER_CH_IRQ);
+}
+
+void notified(microkit_channel ch)
+{
+    if (ch != DRIVER_CH_IRQ) {
+        return;
+    }
+
+    uint64_t t0 = rdtsc();
+    st.handled++;
+
+    uint8_t status = io_in8(REG_STATUS);
+    st.last_status = status;
+    if ((status & STATUS_LEVEL) && (status & STATUS_ASSERT)) {
+        io_out32(REG_ACK, 1);
+    }
+    microkit_irq_ack(DRIVER_CH_IRQ);
+
+    ring_push(status, t0);
+
+    uint64_t cycles = rdtsc() - t0;
+    st.cycles_total += cycles;
+    hist_add(st.hist_cycles, cycles);
+
+    if (st.handled - st.report_base >= REPORT_EVERY) {
+        storm_report();
+    }
+}
+
+microkit_msginfo protected(microkit_channel ch, microkit_msginfo msginfo)
+{
+    if (ch != DRIVER_CH_CLIENT || microkit_msginfo_get_label(msginfo) != STORM_PPC_COUNTERS) {
+        return microkit_msginfo_new(0, 0);
+    }
+    microkit_mr_set(0, st.handled);
+    microkit_mr_set(1, read_u64_lohi_stable(REG_PULSES_LO, REG_PULSES_HI));
+    microkit_mr_set(2, st.notifies);
+    return microkit_msginfo_new(STORM_PPC_COUNTERS, 3);
+}
@@ -1,9 +1,12 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 
 #include <sel4/sel4.h>
+#include <sel4runtime.h>
 #include <simple/simple.h>
 #include <simple-default/simple-default.h>
 #include <sel4platsupport/platsupport.h>
@@ -11,7 +14,7 @@
 /* IRQ storm device layout */
 
 #define STORM_IOBASE     0x560
-#define STORM_IOSIZE     0x20
+#define STORM_IOSIZE     0x80
 
 #define REG_CTRL         (STORM_IOBASE + 0x00)
 #define REG_IRQ          (STORM_IOBASE + 0x01)
@@ -25,16 +28,80 @@
 #define REG_CFG_WRITES   (STORM_IOBASE + 0x14)
 #define REG_EN_TOGGLES   (STORM_IOBASE + 0x18)
 #define REG_ACK          (STORM_IOBASE + 0x1C)
+#define REG_IRQ_AGE_NS   (STORM_IOBASE + 0x20)
+#define REG_DATA         (STORM_IOBASE + 0x24)
+#define REG_DATA_LEN     (STORM_IOBASE + 0x28)
+#define REG_DATA_BYTES   (STORM_IOBASE + 0x2C)
+#define REG_DATA_DROPS   (STORM_IOBASE + 0x30)
+#define REG_DATA_UNDER   (STORM_IOBASE + 0x34)
+#define REG_FIRST_IRQ    (STORM_IOBASE + 0x38)
+#define REG_FIRST_ACK    (STORM_IOBASE + 0x3C)
+#define REG_DMA_ADDR_LO  (STORM_IOBASE + 0x40)
+#define REG_DMA_ADDR_HI  (STORM_IOBASE + 0x44)
+#define REG_DMA_LEN      (STORM_IOBASE + 0x48)
+#define REG_DMA_BW_MIBS  (STORM_IOBASE + 0x4C)
+#define REG_DMA_BYTES_LO (STORM_IOBASE + 0x50)
+#define REG_DMA_BYTES_HI (STORM_IOBASE + 0x54)
+#define REG_DMA_ERRORS   (STORM_IOBASE + 0x58)
+#define REG_CREDITS      (STORM_IOBASE + 0x5C)
+#define REG_DEFERRED     (STORM_IOBASE + 0x60)
+#define REG_PENDING      (STORM_IOBASE + 0x64)
+#define REG_STARVED_US   (STORM_IOBASE + 0x68)
+#define REG_DATA_AVAIL   (STORM_IOBASE + 0x6C)
 
 #define STORM_IRQ        5
 
 #define CTRL_ENABLE      (1u << 0)
 #define CTRL_LEVEL       (1u << 1)
+#define CTRL_DMA         (1u << 2)
+#define CTRL_CREDIT      (1u << 3)
 
 #define STATUS_ENABLED   (1u << 0)
 #define STATUS_ASSERT    (1u << 1)
 #define STATUS_LEVEL     (1u << 2)
 
+/* Notification badges: each source bound to the handler notification gets its own bit */
+
+#define STORM_BADGE      (1u << 0)
+#define CONSOLE_BADGE    (1u << 1)
+#define BP_BADGE         (1u << 2)
+#define STORM2_BADGE     (1u << 3)
+#define STORM3_BADGE     (1u << 4)
+
+/* Console UART (COM2). COM1 stays with the kernel for debug output. */
+
+#define CONSOLE_IOBASE   0x2F8
+#define CONSOLE_IOSIZE   8
+#define CONSOLE_IRQ      3
+
+#define UART_RBR         (CONSOLE_IOBASE + 0)
+#define UART_THR         (CONSOLE_IOBASE + 0)
+#define UART_DLL         (CONSOLE_IOBASE + 0)
+#define UART_IER         (CONSOLE_IOBASE + 1)
+#define UART_DLM         (CONSOLE_IOBASE + 1)
+#define UART_FCR         (CONSOLE_IOBASE + 2)
+#define UART_LCR         (CONSOLE_IOBASE + 3)
+#define UART_MCR         (CONSOLE_IOBASE + 4)
+#define UART_LSR         (CONSOLE_IOBASE + 5)
+
+#define UART_IER_RDA     (1u << 0)
+#define UART_FCR_ENABLE  0x07 /* enable + clear both FIFOs, 1-byte trigger */
+#define UART_LCR_8N1     0x03
+#define UART_LCR_DLAB    (1u << 7)
+#define UART_MCR_DTR_RTS 0x03
+#define UART_MCR_OUT2    (1u << 3) /* gates the UART IRQ line on PC hardware */
+#define UART_LSR_DR      (1u << 0)
+#define UART_LSR_THRE    (1u << 5)
+
+/* Secondary threads. The storm handler keeps the root task's priority. */
+
+#define CONSOLE_PRIO     50
+#define CONSUMER_PRIO    100
+#define SPINNER_PRIO     1
+
+#define THREAD_STACK_SIZE (16 * 1024)
+#define THREAD_TLS_SIZE   1024
+
 static simple_t simple;
 
 static seL4_CPtr find_untyped_or_die(seL4_BootInfo *bi, uint8_t min_size_bits)
@@ -86,6 +153,136 @@ static seL4_CPtr cslot_alloc_or_die(cslot_window_t *w)
     return w->cur++;
 }
 
+static void retype_or_die(seL4_BootInfo *bi, seL4_Word type, uint8_t size_bits, seL4_CPtr slot)
+{
+    seL4_CPtr ut = find_untyped_or_die(bi, size_bits);
+    seL4_Error err = seL4_Untyped_Retype(ut, type, 0, seL4_CapInitThreadCNode, 0, 0, slot, 1);
+    if (err) {
+        printf("Untyped_Retype type=%lu err=%d\n", (unsigned long)type, (int)err);
+        seL4_DebugHalt();
+    }
+}
+
+/*
+ * Carve a 2^size_bits RAM region for the device to DMA into, as a child
+ * untyped that is never retyped further. The parent is taken from the end of
+ * the list so it is not the one find_untyped_or_die() has already retyped
+ * from: a fresh parent places its first child at its own paddr. The rest of
+ * the parent stays available to the allocator.
+ */
+static uint64_t dma_region_carve_or_die(seL4_BootInfo *bi, cslot_window_t *w, uint8_t size_bits)
+{
+    int in_use = (int)(find_untyped_or_die(bi, seL4_NotificationBits) - bi->untyped.start);
+
+    for (int idx = (int)(bi->untyped.end - bi->untyped.start) - 1; idx >= 0; idx--) {
+        if (bi->untypedList[idx].isDevice || idx == in_use) {
+            continue;
+        }
+        if (bi->untypedList[idx].sizeBits >= size_bits) {
+            seL4_Error err = seL4_Untyped_Retype(bi->untyped.start + idx, seL4_UntypedObject,
+                                                 size_bits, seL4_CapInitThreadCNode, 0, 0,
+                                                 cslot_alloc_or_die(w), 1);
+            if (err) {
+                printf("Untyped_Retype DMA region err=%d\n", (int)err);
+                seL4_DebugHalt();
+            }
+            return bi->untypedList[idx].paddr;
+        }
+    }
+    printf("No untyped for a %u-bit DMA region\n", (unsigned)size_bits);
+    seL4_DebugHalt();
+    return 0;
+}
+
+static seL4_CPtr mint_badged_or_die(cslot_window_t *w, seL4_CPtr src, seL4_Word badge)
+{
+    seL4_CPtr slot = cslot_alloc_or_die(w);
+    seL4_Error err = seL4_CNode_Mint(seL4_CapInitThreadCNode, slot, seL4_WordBits,
+                                     seL4_CapInitThreadCNode, src, seL4_WordBits,
+                                     seL4_AllRights, badge);
+    if (err) {
+        printf("CNode_Mint badge=0x%lx err=%d\n", (unsigned long)badge, (int)err);
+        seL4_DebugHalt();
+    }
+    return slot;
+}
+
+/* Thread helpers */
+
+extern char __executable_start[];
+
+typedef struct {
+    uint8_t ipc_buf[BIT(seL4_PageBits)];
+    uint8_t tls[THREAD_TLS_SIZE];
+    uint8_t stack[THREAD_STACK_SIZE];
+} __attribute__((aligned(BIT(seL4_PageBits)))) thread_mem_t;
+
+/* Frame cap backing a page of our own image (used for secondary IPC buffers) */
+static seL4_CPtr image_frame_cap(seL4_BootInfo *bi, void *vaddr)
+{
+    uintptr_t base = (uintptr_t)__executable_start & ~(uintptr_t)(BIT(seL4_PageBits) - 1);
+    return bi->userImageFrames.start + (((uintptr_t)vaddr - base) >> seL4_PageBits);
+}
+
+static seL4_CPtr spawn_thread_or_die(seL4_BootInfo *bi, cslot_window_t *w, thread_mem_t *mem,
+                                     void (*entry)(void *), void *arg, uint8_t prio, bool start)
+{
+    seL4_CPtr tcb = cslot_alloc_or_die(w);
+    retype_or_die(bi, seL4_TCBObject, seL4_TCBBits, tcb);
+
+    seL4_Error err = seL4_TCB_Configure(tcb, seL4_CapNull,
+                             seL4_CapInitThreadCNode, 0,
+                             seL4_CapInitThreadVSpace, 0,
+                             (seL4_Word)mem->ipc_buf, image_frame_cap(bi, mem->ipc_buf));
+    assert(err == 0);
+    err = seL4_TCB_SetPriority(tcb, seL4_CapInitThreadTCB, prio);
+    assert(err == 0);
+
+    /* libsel4 finds the IPC buffer through TLS, so every thread needs its own */
+    assert(sel4runtime_get_tls_size() <= sizeof(mem->tls));
+    uintptr_t tp = sel4runtime_write_tls_image(mem->tls);
+    assert(tp);
+    sel4runtime_set_tls_variable(tp, __sel4_ipc_buffer, (seL4_IPCBuffer *)mem->ipc_buf);
+    err = seL4_TCB_SetTLSBase(tcb, tp);
+    assert(err == 0);
+
+    /* Entry as if called: rsp + 8 is 16-byte aligned */
+    seL4_UserContext regs = {0};
+    regs.rip = (seL4_Word)entry;
+    regs.rdi = (seL4_Word)arg;
+    regs.rsp = (seL4_Word)(mem->stack + sizeof(mem->stack)) - sizeof(seL4_Word);
+    err = seL4_TCB_WriteRegisters(tcb, start, 0, sizeof(regs) / sizeof(seL4_Word), &regs);
+    assert(err == 0);
+
+    return tcb;
+}
+
+static inline uint64_t rdtsc(void)
+{
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+/* TSC frequency from the extended bootinfo, 0 if the kernel did not provide it */
+static uint32_t bootinfo_tsc_mhz(seL4_BootInfo *bi)
+{
+    uintptr_t cur = (uintptr_t)bi + BIT(seL4_PageBits);
+    uintptr_t end = cur + bi->extraLen;
+
+    while (cur < end) {
+        seL4_BootInfoHeader *h = (seL4_BootInfoHeader *)cur;
+        if (h->id == SEL4_BOOTINFO_HEADER_X86_TSC_FREQ) {
+            return *(uint32_t *)(h + 1);
+        }
+        if (h->len == 0) {
+            break;
+        }
+        cur += h->len;
+    }
+    return 0;
+}
+
 /* x86 I/O helpers */
 
 static inline uint8_t io_in8(seL4_X86_IOPort io, uint16_t port)
@@ -97,6 +294,15 @@ static inline uint8_t io_in8(seL4_X86_IOPort io, uint16_t port)
     return (uint8_t)r.result;
 }
 
+static inline uint16_t io_in16(seL4_X86_IOPort io, uint16_t port)
+{
+    seL4_X86_IOPort_In16_t r = seL4_X86_IOPort_In16(io, port);
+    if (r.error) {
+        printf("IOPort_In16 error=%ld port=0x%x\n", (long)r.error, port);
+    }
+    return (uint16_t)r.result;
+}
+
 static inline uint32_t io_in32(seL4_X86_IOPort io, uint16_t port)
 {
     seL4_X86_IOPort_In32_t r = seL4_X86_IOPort_In32(io, port);
@@ -144,141 +350,2116 @@ static inline void print_cfg(seL4_X86_IOPort io)
            (unsigned)ctrl, (unsigned)status, (unsigned)burst, (unsigned)period);
 }
 
-int main(void)
+/* Handler statistics */
+
+#define HIST_BUCKETS     64
+
+typedef struct {
+    uint64_t handled;
+    uint64_t report_base;       /* handled count at the previous report */
+    uint64_t cycles_total;      /* handler cycles, status read through IRQ ack */
+    uint64_t hist_cycles[HIST_BUCKETS]; /* log2 buckets of per-IRQ handler cycles */
+    uint64_t lat_total_ns;      /* device raise -> handler entry, device virtual time */
+    uint64_t lat_samples;
+    uint64_t hist_lat_ns[HIST_BUCKETS];
+
+    uint64_t last_cycles_total;
+    uint64_t last_lat_total_ns;
+    uint64_t last_lat_samples;
+    uint64_t last_spin;
+    uint64_t last_tsc;
+    uint64_t last_pulses;
+    uint32_t last_timer_cb;
+    uint32_t last_cfg_writes;
+    uint32_t last_en_toggles;
+
+    seL4_Word last_badge;
+    uint8_t last_status;
+} storm_stats_t;
+
+static inline void hist_add(uint64_t *hist, uint64_t v)
 {
-    seL4_BootInfo *bi = platsupport_get_bootinfo();
-    assert(bi);
-    simple_default_init_bootinfo(&simple, bi);
+    hist[63 - __builtin_clzll(v | 1)]++;
+}
 
-    printf("seL4 pc99: isa-irq-storm demo start (new device, no DebugRunTime)\n");
+/* Background load: keeps the core out of the idle thread's HLT when resumed */
 
-    cslot_window_t win = reserve_cslot_window_from_end(bi, 32);
+typedef enum {
+    IDLE_HALT,   /* nothing else runnable, the kernel idles (HLT) between IRQs */
+    IDLE_BUSY,   /* lowest-priority spinner keeps the core busy */
+} idle_mode_t;
 
-    seL4_CPtr ntfn_slot   = cslot_alloc_or_die(&win);
-    seL4_CPtr irqh_slot   = cslot_alloc_or_die(&win);
-    seL4_CPtr ioport_slot = cslot_alloc_or_die(&win);
-    (void)cslot_alloc_or_die(&win);
+static volatile uint64_t spin_loops;
+static thread_mem_t spinner_mem;
 
-    seL4_CPtr ut = find_untyped_or_die(bi, seL4_NotificationBits);
+static void spinner_thread(void *arg)
+{
+    (void)arg;
+    while (1) {
+        spin_loops++;
+    }
+}
 
-    seL4_Error err = seL4_Untyped_Retype(
-        ut,
-        seL4_NotificationObject,
-        0,
-        seL4_CapInitThreadCNode,
-        0,
-        0,
-        ntfn_slot,
-        1
-    );
-    assert(err == 0);
-    seL4_CPtr ntfn = ntfn_slot;
+static inline uint64_t avg_or_zero(uint64_t sum, uint64_t n)
+{
+    return n ? sum / n : 0;
+}
 
-    err = seL4_X86_IOPortControl_Issue(
-        seL4_CapIOPortControl,
-        STORM_IOBASE,
-        (uint16_t)(STORM_IOBASE + STORM_IOSIZE - 1),
-        seL4_CapInitThreadCNode,
-        ioport_slot,
-        seL4_WordBits
-    );
-    assert(err == 0);
-    seL4_X86_IOPort io = (seL4_X86_IOPort)ioport_slot;
+static inline uint64_t cycles_to_us(uint64_t cycles, uint32_t tsc_mhz)
+{
+    return tsc_mhz ? cycles / tsc_mhz : 0;
+}
 
-    err = seL4_IRQControl_GetIOAPIC(
-        seL4_CapIRQControl,
-        seL4_CapInitThreadCNode,
-        irqh_slot,
-        seL4_WordBits,
-        0,
-        STORM_IRQ,
-        1,
-        1,
-        STORM_IRQ
-    );
-    assert(err == 0);
-    seL4_CPtr irq_handler = irqh_slot;
+/* `count` per second over `cycles`; count * tsc_mhz * 10^6 would overflow past ~6e9 */
+static inline uint64_t per_s(uint64_t count, uint64_t cycles, uint32_t tsc_mhz)
+{
+    uint64_t us = cycles_to_us(cycles, tsc_mhz);
+    return us ? count / us * 1000000ULL + count % us * 1000000ULL / us : 0;
+}
 
-    err = seL4_IRQHandler_SetNotification(irq_handler, ntfn);
-    assert(err == 0);
-    err = seL4_IRQHandler_Ack(irq_handler);
-    assert(err == 0);
+static void stats_reset(seL4_X86_IOPort io, storm_stats_t *st)
+{
+    memset(st, 0, sizeof(*st));
+    st->last_spin = spin_loops;
+    st->last_tsc = rdtsc();
+    st->last_pulses = read_u64_lohi_stable(io, REG_PULSES_LO, REG_PULSES_HI);
+    st->last_timer_cb = io_in32(io, REG_TIMER_CB);
+    st->last_cfg_writes = io_in32(io, REG_CFG_WRITES);
+    st->last_en_toggles = io_in32(io, REG_EN_TOGGLES);
+    st->last_status = io_in8(io, REG_STATUS);
+}
 
-    printf("Device reports IRQ line: %u\n", (unsigned)io_in8(io, REG_IRQ));
-    print_cfg(io);
+static void print_hist(const char *name, const uint64_t *hist)
+{
+    uint64_t total = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        total += hist[i];
+    }
+    printf("hist: %s total=%llu\n", name, (unsigned long long)total);
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        if (hist[i]) {
+            printf("hist: %s 2^%d %llu\n", name, i, (unsigned long long)hist[i]);
+        }
+    }
+}
 
-    /* Ensure enabled (do not change LEVEL bit set by QEMU unless you want to) */
-    uint8_t ctrl = io_in8(io, REG_CTRL);
-    if (!(ctrl & CTRL_ENABLE)) {
-        ctrl |= CTRL_ENABLE;
-        io_out8(io, REG_CTRL, ctrl);
+static void storm_report(seL4_X86_IOPort io, storm_stats_t *st)
+{
+    uint64_t tsc = rdtsc();
+    uint64_t pulses = read_u64_lohi_stable(io, REG_PULSES_LO, REG_PULSES_HI);
+    uint32_t timer_cb = io_in32(io, REG_TIMER_CB);
+    uint32_t cfg_writes = io_in32(io, REG_CFG_WRITES);
+    uint32_t en_toggles = io_in32(io, REG_EN_TOGGLES);
+
+    uint64_t dpulses = pulses - st->last_pulses;
+    uint32_t dtimer_cb = timer_cb - st->last_timer_cb;
+    uint32_t dcfg = cfg_writes - st->last_cfg_writes;
+    uint32_t dtog = en_toggles - st->last_en_toggles;
+
+    uint8_t cur_ctrl = io_in8(io, REG_CTRL);
+    uint32_t cur_burst = io_in8(io, REG_BURST);
+    uint32_t cur_period = io_in32(io, REG_PERIOD_US);
+
+    printf("storm: handled=%llu (+%llu) dpulses=%llu dtimer_cb=%u dcfg=%u dtog=%u ctrl=0x%02x status=0x%02x badge=0x%lx burst=%u period-us=%u total_pulses=%llu dtsc=%llu\n",
+           (unsigned long long)st->handled,
+           (unsigned long long)(st->handled - st->report_base),
+           (unsigned long long)dpulses,
+           (unsigned)dtimer_cb,
+           (unsigned)dcfg,
+           (unsigned)dtog,
+           (unsigned)cur_ctrl,
+           (unsigned)st->last_status,
+           (unsigned long)st->last_badge,
+           (unsigned)cur_burst,
+           (unsigned)cur_period,
+           (unsigned long long)pulses,
+           (unsigned long long)(tsc - st->last_tsc));
+
+    uint64_t spin = spin_loops;
+    printf("idle: spin=%llu avg-cycles=%llu lat-samples=%llu avg-lat-ns=%llu\n",
+           (unsigned long long)(spin - st->last_spin),
+           (unsigned long long)avg_or_zero(st->cycles_total - st->last_cycles_total,
+                                           st->handled - st->report_base),
+           (unsigned long long)(st->lat_samples - st->last_lat_samples),
+           (unsigned long long)avg_or_zero(st->lat_total_ns - st->last_lat_total_ns,
+                                           st->lat_samples - st->last_lat_samples));
+
+    st->report_base = st->handled;
+    st->last_cycles_total = st->cycles_total;
+    st->last_lat_total_ns = st->lat_total_ns;
+    st->last_lat_samples = st->lat_samples;
+    st->last_spin = spin;
+    st->last_tsc = tsc;
+    st->last_pulses = pulses;
+    st->last_timer_cb = timer_cb;
+    st->last_cfg_writes = cfg_writes;
+    st->last_en_toggles = en_toggles;
+}
+
+/* Period sweep: doubles (or halves) period-us every `reports` report intervals */
+
+typedef struct {
+    bool active;
+    uint32_t period_us;
+    uint32_t to_us;
+    uint32_t reports;
+    uint32_t reports_left;
+    uint64_t handled_base;
+    uint64_t pulses_base;
+    uint64_t cycles_base;
+    uint64_t lat_total_base;
+    uint64_t lat_samples_base;
+    uint64_t spin_base;
+} sweep_t;
+
+static void sweep_begin_step(seL4_X86_IOPort io, storm_stats_t *st, sweep_t *sw)
+{
+    io_out32(io, REG_PERIOD_US, sw->period_us);
+    sw->reports_left = sw->reports;
+    sw->handled_base = st->handled;
+    sw->pulses_base = read_u64_lohi_stable(io, REG_PULSES_LO, REG_PULSES_HI);
+    sw->cycles_base = st->cycles_total;
+    sw->lat_total_base = st->lat_total_ns;
+    sw->lat_samples_base = st->lat_samples;
+    sw->spin_base = spin_loops;
+}
+
+static void sweep_start(seL4_X86_IOPort io, storm_stats_t *st, sweep_t *sw,
+                        uint32_t from_us, uint32_t to_us, uint32_t reports)
+{
+    sw->active = true;
+    sw->period_us = from_us;
+    sw->to_us = to_us;
+    sw->reports = reports;
+    printf("sweep: start from-us=%u to-us=%u reports-per-step=%u\n",
+           (unsigned)from_us, (unsigned)to_us, (unsigned)reports);
+    sweep_begin_step(io, st, sw);
+}
+
+/* Called after every report while a sweep is active */
+static void sweep_tick(seL4_X86_IOPort io, storm_stats_t *st, sweep_t *sw)
+{
+    if (!sw->active || --sw->reports_left) {
+        return;
     }
 
-    /* Reporting cadence: every N handled notifications */
-    const uint64_t report_every_handled = 1ULL << 16; /* 65536 */
-    uint64_t handled = 0;
+    uint64_t handled = st->handled - sw->handled_base;
+    uint64_t pulses = read_u64_lohi_stable(io, REG_PULSES_LO, REG_PULSES_HI) - sw->pulses_base;
+    uint64_t cycles = st->cycles_total - sw->cycles_base;
 
-    uint64_t last_pulses = read_u64_lohi_stable(io, REG_PULSES_LO, REG_PULSES_HI);
-    uint32_t last_timer_cb = io_in32(io, REG_TIMER_CB);
-    uint32_t last_cfg_writes = io_in32(io, REG_CFG_WRITES);
-    uint32_t last_en_toggles = io_in32(io, REG_EN_TOGGLES);
+    printf("sweep: period-us=%u handled=%llu pulses=%llu avg-cycles=%llu avg-lat-ns=%llu spin=%llu\n",
+           (unsigned)sw->period_us,
+           (unsigned long long)handled,
+           (unsigned long long)pulses,
+           (unsigned long long)avg_or_zero(cycles, handled),
+           (unsigned long long)avg_or_zero(st->lat_total_ns - sw->lat_total_base,
+                                           st->lat_samples - sw->lat_samples_base),
+           (unsigned long long)(spin_loops - sw->spin_base));
 
-    seL4_Word last_badge = 0;
-    uint8_t last_status = io_in8(io, REG_STATUS);
+    if (sw->period_us == sw->to_us) {
+        sw->active = false;
+        printf("sweep: done\n");
+        return;
+    }
+    if (sw->period_us < sw->to_us) {
+        sw->period_us = (sw->period_us > sw->to_us / 2) ? sw->to_us : sw->period_us * 2;
+    } else {
+        sw->period_us = (sw->period_us / 2 < sw->to_us) ? sw->to_us : sw->period_us / 2;
+    }
+    sweep_begin_step(io, st, sw);
+}
 
-    while (1) {
-        seL4_Word badge = 0;
-        seL4_Wait(ntfn, &badge);
-        handled++;
-        last_badge = badge;
+/*
+ * Event pipeline: capture -> classify -> checksum -> enqueue.
+ *
+ * Capture turns newly emitted device pulses into events (each with a
+ * synthetic payload). Every stage, capture included, runs once at least
+ * `batch` events wait at its input and then takes all of them, so no device
+ * backlog builds up behind the batch size. Enqueue hands the events to a
+ * lower-priority consumer thread with one seL4_Signal per batch. Staging is
+ * flushed through every stage when it fills up.
+ */
 
-        /* Minimal per-IRQ work */
-        uint8_t status = io_in8(io, REG_STATUS);
-        last_status = status;
+enum {
+    PIPE_CAPTURE,
+    PIPE_CLASSIFY,
+    PIPE_CHECKSUM,
+    PIPE_ENQUEUE,
+    PIPE_STAGES,
+};
 
-        /* If device is in LEVEL mode and currently asserted, ACK it */
-        if ((status & STATUS_LEVEL) && (status & STATUS_ASSERT)) {
-            io_out32(io, REG_ACK, 1);
+static const char *const pipe_stage_names[PIPE_STAGES] = {
+    "capture", "classify", "checksum", "enqueue",
+};
+
+#define PIPE_SLOTS       64   /* staging capacity, also the largest batch */
+#define PIPE_PAYLOAD_MAX 2048
+#define PIPE_RING_SLOTS  1024 /* power of two */
+
+typedef struct {
+    uint64_t tsc;
+    uint32_t seq;
+    uint32_t csum;
+    uint8_t status;
+    uint8_t cls;
+} pipe_event_t;
+
+typedef struct {
+    uint32_t batch[PIPE_STAGES];
+    uint32_t payload_bytes;
+
+    pipe_event_t ev[PIPE_SLOTS];
+    uint32_t done[PIPE_STAGES];      /* staged events that have passed each stage */
+    uint32_t seq;
+    uint32_t captured_pulses;        /* low 32 bits of device pulses already captured */
+
+    uint64_t events[PIPE_STAGES];
+    uint64_t runs[PIPE_STAGES];
+    uint64_t cycles[PIPE_STAGES];
+    uint64_t irqs;
+    uint64_t dropped;                /* consumer ring full */
+    uint64_t start_tsc;
+} pipeline_t;
+
+/* Whole 64-bit words: payload_bytes is a multiple of 8 */
+static uint64_t pipe_payload[PIPE_SLOTS][PIPE_PAYLOAD_MAX / sizeof(uint64_t)];
+
+/* Single producer (handler), single consumer (consumer thread) */
+typedef struct {
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    pipe_event_t ev[PIPE_RING_SLOTS];
+} pipe_ring_t;
+
+static pipe_ring_t pipe_ring;
+
+typedef struct {
+    seL4_CPtr ntfn;
+    seL4_CPtr bp_ntfn;      /* handler notification badged with BP_BADGE */
+    volatile bool bp_armed; /* handler wants a BP_BADGE once the ring is drained */
+    uint64_t consumed;
+    uint64_t wakeups;
+    uint64_t seq_gaps;
+    uint32_t next_seq;
+} consumer_t;
+
+static consumer_t consumer;
+static thread_mem_t consumer_mem;
+
+static inline uint32_t pipe_backlog(void)
+{
+    return pipe_ring.head - __atomic_load_n(&pipe_ring.tail, __ATOMIC_ACQUIRE);
+}
+
+static void pipeline_reset(seL4_X86_IOPort io, pipeline_t *p)
+{
+    memset(p->done, 0, sizeof(p->done));
+    memset(p->events, 0, sizeof(p->events));
+    memset(p->runs, 0, sizeof(p->runs));
+    memset(p->cycles, 0, sizeof(p->cycles));
+    p->irqs = 0;
+    p->dropped = 0;
+    p->captured_pulses = io_in32(io, REG_PULSES_LO);
+    p->start_tsc = rdtsc();
+}
+
+static void pipeline_configure(seL4_X86_IOPort io, pipeline_t *p,
+                               const uint32_t *batch, uint32_t payload_bytes)
+{
+    for (int i = 0; i < PIPE_STAGES; i++) {
+        p->batch[i] = batch[i] ? (batch[i] > PIPE_SLOTS ? PIPE_SLOTS : batch[i]) : 1;
+    }
+    p->payload_bytes = payload_bytes > PIPE_PAYLOAD_MAX ? PIPE_PAYLOAD_MAX : payload_bytes;
+    p->payload_bytes &= ~(uint32_t)(sizeof(uint64_t) - 1);
+    pipeline_reset(io, p);
+}
+
+static void pipe_capture(pipeline_t *p, uint8_t status, uint32_t n)
+{
+    uint64_t tsc = rdtsc();
+
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t slot = p->done[PIPE_CAPTURE] + i;
+        pipe_event_t *ev = &p->ev[slot];
+        ev->tsc = tsc;
+        ev->seq = p->seq++;
+        ev->status = status;
+
+        /* Synthetic payload, as if the device had just delivered it */
+        uint64_t *w = pipe_payload[slot];
+        uint64_t v = (uint64_t)ev->seq * 0x9E3779B97F4A7C15ULL;
+        for (uint32_t j = 0; j < p->payload_bytes / sizeof(uint64_t); j++) {
+            w[j] = v + j;
+        }
+    }
+    p->captured_pulses += n;
+}
+
+static void pipe_classify(pipeline_t *p, uint32_t from, uint32_t to)
+{
+    for (uint32_t i = from; i < to; i++) {
+        pipe_event_t *ev = &p->ev[i];
+        ev->cls = (uint8_t)(((ev->status & STATUS_LEVEL) ? 4 : 0) | (pipe_payload[i][0] & 3));
+    }
+}
+
+static void pipe_checksum(pipeline_t *p, uint32_t from, uint32_t to)
+{
+    for (uint32_t i = from; i < to; i++) {
+        const uint64_t *w = pipe_payload[i];
+        uint32_t a = 1, b = 0;
+        /* 32-bit Fletcher over the payload, low half of each word first */
+        for (uint32_t j = 0; j < p->payload_bytes / sizeof(uint64_t); j++) {
+            a += (uint32_t)w[j];
+            b += a;
+            a += (uint32_t)(w[j] >> 32);
+            b += a;
         }
+        p->ev[i].csum = a ^ b;
+    }
+}
 
-        err = seL4_IRQHandler_Ack(irq_handler);
-        if (err) {
-            printf("IRQHandler_Ack error: %d\n", (int)err);
-        }
-
-        if ((handled & (report_every_handled - 1)) == 0) {
-            uint64_t pulses = read_u64_lohi_stable(io, REG_PULSES_LO, REG_PULSES_HI);
-            uint32_t timer_cb = io_in32(io, REG_TIMER_CB);
-            uint32_t cfg_writes = io_in32(io, REG_CFG_WRITES);
-            uint32_t en_toggles = io_in32(io, REG_EN_TOGGLES);
-
-            uint64_t dpulses = pulses - last_pulses;
-            uint32_t dtimer_cb = timer_cb - last_timer_cb;
-            uint32_t dcfg = cfg_writes - last_cfg_writes;
-            uint32_t dtog = en_toggles - last_en_toggles;
-
-            uint8_t cur_ctrl = io_in8(io, REG_CTRL);
-            uint32_t cur_burst = io_in8(io, REG_BURST);
-            uint32_t cur_period = io_in32(io, REG_PERIOD_US);
-
-            printf("storm: handled=%llu (+%llu) dpulses=%llu dtimer_cb=%u dcfg=%u dtog=%u ctrl=0x%02x status=0x%02x badge=0x%lx burst=%u period-us=%u total_pulses=%llu\n",
-                   (unsigned long long)handled,
-                   (unsigned long long)report_every_handled,
-                   (unsigned long long)dpulses,
-                   (unsigned)dtimer_cb,
-                   (unsigned)dcfg,
-                   (unsigned)dtog,
-                   (unsigned)cur_ctrl,
-                   (unsigned)last_status,
-                   (unsigned long)last_badge,
-                   (unsigned)cur_burst,
-                   (unsigned)cur_period,
-                   (unsigned long long)pulses);
-
-            last_pulses = pulses;
-            last_timer_cb = timer_cb;
-            last_cfg_writes = cfg_writes;
-            last_en_toggles = en_toggles;
+static void pipe_enqueue(pipeline_t *p, uint32_t from, uint32_t to)
+{
+    uint32_t head = pipe_ring.head;
+
+    for (uint32_t i = from; i < to; i++) {
+        if (head - __atomic_load_n(&pipe_ring.tail, __ATOMIC_ACQUIRE) >= PIPE_RING_SLOTS) {
+            p->dropped++;
+            continue;
+        }
+        pipe_ring.ev[head & (PIPE_RING_SLOTS - 1)] = p->ev[i];
+        head++;
+    }
+    __atomic_store_n(&pipe_ring.head, head, __ATOMIC_RELEASE);
+    seL4_Signal(consumer.ntfn);
+}
+
+/* Run stage `s` over everything waiting at its input if the batch is reached */
+static void pipe_stage(pipeline_t *p, int s, bool flush)
+{
+    uint32_t from = p->done[s];
+    uint32_t to = p->done[s - 1];
+
+    if (to == from || (!flush && to - from < p->batch[s])) {
+        return;
+    }
+
+    uint64_t t0 = rdtsc();
+    switch (s) {
+    case PIPE_CLASSIFY:
+        pipe_classify(p, from, to);
+        break;
+    case PIPE_CHECKSUM:
+        pipe_checksum(p, from, to);
+        break;
+    case PIPE_ENQUEUE:
+        pipe_enqueue(p, from, to);
+        break;
+    }
+    p->cycles[s] += rdtsc() - t0;
+    p->events[s] += to - from;
+    p->runs[s]++;
+    p->done[s] = to;
+}
+
+/* Per-IRQ entry point, after the handler's status read and device ACK */
+/* Capture `pending` events, pushing staging through every stage when it fills (always with flush) */
+static void pipeline_take(pipeline_t *p, uint8_t status, uint32_t pending, bool flush)
+{
+    do {
+        uint32_t room = PIPE_SLOTS - p->done[PIPE_CAPTURE];
+        uint32_t n = pending < room ? pending : room;
+
+        if (n) {
+            uint64_t t0 = rdtsc();
+            pipe_capture(p, status, n);
+            p->cycles[PIPE_CAPTURE] += rdtsc() - t0;
+            p->events[PIPE_CAPTURE] += n;
+            p->runs[PIPE_CAPTURE]++;
+            p->done[PIPE_CAPTURE] += n;
+            pending -= n;
+        }
+
+        bool full = flush || p->done[PIPE_CAPTURE] == PIPE_SLOTS;
+        for (int s = PIPE_CLASSIFY; s < PIPE_STAGES; s++) {
+            pipe_stage(p, s, full);
+        }
+
+        if (p->done[PIPE_ENQUEUE] == p->done[PIPE_CAPTURE]) {
+            memset(p->done, 0, sizeof(p->done));
+        }
+    } while (pending);
+}
+
+static uint32_t pipe_pending(seL4_X86_IOPort io, pipeline_t *p)
+{
+    uint64_t t0 = rdtsc();
+    uint32_t pending = io_in32(io, REG_PULSES_LO) - p->captured_pulses;
+    p->cycles[PIPE_CAPTURE] += rdtsc() - t0;
+    return pending;
+}
+
+static void pipeline_run(seL4_X86_IOPort io, pipeline_t *p, uint8_t status)
+{
+    p->irqs++;
+
+    uint32_t pending = pipe_pending(io, p);
+    if (pending >= p->batch[PIPE_CAPTURE]) {
+        pipeline_take(p, status, pending, false);
+    }
+}
+
+/* Push everything the device has emitted through to the ring, below-batch leftovers included */
+static void pipeline_flush(seL4_X86_IOPort io, pipeline_t *p, uint8_t status)
+{
+    pipeline_take(p, status, pipe_pending(io, p), true);
+}
+
+static void pipeline_report(pipeline_t *p, uint32_t tsc_mhz)
+{
+    uint64_t out = p->events[PIPE_ENQUEUE];
+    uint64_t dtsc = rdtsc() - p->start_tsc;
+
+    printf("pipe: batch=%u/%u/%u/%u payload=%u irqs=%llu events=%llu ev-per-irq=%llu ev-per-s=%llu dropped=%llu backlog=%u consumed=%llu consumer-wakeups=%llu\n",
+           (unsigned)p->batch[PIPE_CAPTURE], (unsigned)p->batch[PIPE_CLASSIFY],
+           (unsigned)p->batch[PIPE_CHECKSUM], (unsigned)p->batch[PIPE_ENQUEUE],
+           (unsigned)p->payload_bytes,
+           (unsigned long long)p->irqs,
+           (unsigned long long)out,
+           (unsigned long long)(p->irqs ? out / p->irqs : 0),
+           (unsigned long long)per_s(out, dtsc, tsc_mhz),
+           (unsigned long long)p->dropped,
+           (unsigned)pipe_backlog(),
+           (unsigned long long)consumer.consumed,
+           (unsigned long long)consumer.wakeups);
+
+    for (int s = 0; s < PIPE_STAGES; s++) {
+        printf("pipe: stage=%s runs=%llu events=%llu cycles-per-event=%llu\n",
+               pipe_stage_names[s],
+               (unsigned long long)p->runs[s],
+               (unsigned long long)p->events[s],
+               (unsigned long long)(p->events[s] ? p->cycles[s] / p->events[s] : 0));
+    }
+}
+
+static void consumer_thread(void *arg)
+{
+    consumer_t *c = arg;
+
+    while (1) {
+        seL4_Word badge;
+        seL4_Wait(c->ntfn, &badge);
+        c->wakeups++;
+
+        uint32_t tail = pipe_ring.tail;
+        uint32_t head = __atomic_load_n(&pipe_ring.head, __ATOMIC_ACQUIRE);
+        while (tail != head) {
+            const pipe_event_t *ev = &pipe_ring.ev[tail & (PIPE_RING_SLOTS - 1)];
+            if (ev->seq != c->next_seq) {
+                c->seq_gaps++;
+            }
+            c->next_seq = ev->seq + 1;
+            c->consumed++;
+            tail++;
+        }
+        __atomic_store_n(&pipe_ring.tail, tail, __ATOMIC_RELEASE);
+        if (__atomic_exchange_n(&c->bp_armed, false, __ATOMIC_ACQ_REL)) {
+            seL4_Signal(c->bp_ntfn);
+        }
+    }
+}
+
+static void consumer_start(seL4_BootInfo *bi, cslot_window_t *win, seL4_CPtr bp_ntfn)
+{
+    consumer.bp_ntfn = bp_ntfn;
+    consumer.ntfn = cslot_alloc_or_die(win);
+    retype_or_die(bi, seL4_NotificationObject, seL4_NotificationBits, consumer.ntfn);
+    (void)spawn_thread_or_die(bi, win, &consumer_mem, consumer_thread, &consumer, CONSUMER_PRIO, true);
+}
+
+/*
+ * Backpressure from the consumer ring to the device, pipeline handler only.
+ *
+ * toggle: clear CTRL_ENABLE once the ring plus staging reaches BP_HIGH and set
+ *         it again at BP_LOW, the device restarting its period on each toggle.
+ * credit: keep the device's unspent credits (REG_CREDITS), its uncaptured
+ *         pulses and everything queued at or below the ring size; the grant
+ *         shrinks as the backlog grows and the device defers events instead
+ *         of stopping its timer.
+ * When nothing can be done until the consumer drains the ring, the handler
+ * arms the consumer to wake it with BP_BADGE. That wake-up first flushes the
+ * pipeline, so with the ring drained nothing but the device's own credits
+ * counts against a grant.
+ */
+
+#define BP_HIGH          (PIPE_RING_SLOTS * 3 / 4)
+#define BP_LOW           (PIPE_RING_SLOTS / 4)
+#define BP_GRANT_MIN     (PIPE_RING_SLOTS / 8) /* fewer, larger REG_CREDITS writes */
+
+typedef enum {
+    BP_OFF,
+    BP_TOGGLE,
+    BP_CREDIT,
+    BP_MODES,
+} bp_mode_t;
+
+static const char *const bp_mode_names[BP_MODES] = {
+    "off", "toggle", "credit",
+};
+
+typedef struct {
+    bp_mode_t mode;
+    uint64_t granted_total;
+    uint64_t grants;
+    bool paused;
+    uint64_t pauses;
+    uint64_t pause_tsc;
+    uint64_t paused_cycles;
+    uint32_t dev_deferred_base;
+    uint32_t dev_starved_base;
+    uint32_t dev_toggles_base;
+    uint64_t start_tsc;
+} bp_t;
+
+static void bp_set_enable(seL4_X86_IOPort io, bool on)
+{
+    uint8_t ctrl = io_in8(io, REG_CTRL);
+    io_out8(io, REG_CTRL, on ? (ctrl | CTRL_ENABLE) : (ctrl & ~CTRL_ENABLE));
+}
+
+static void bp_run(seL4_X86_IOPort io, bp_t *b, pipeline_t *p)
+{
+    uint32_t queued = pipe_backlog() + p->done[PIPE_CAPTURE] - p->done[PIPE_ENQUEUE];
+
+    switch (b->mode) {
+    case BP_TOGGLE:
+        if (!b->paused && queued >= BP_HIGH) {
+            bp_set_enable(io, false);
+            b->paused = true;
+            b->pauses++;
+            b->pause_tsc = rdtsc();
+        } else if (b->paused && queued <= BP_LOW) {
+            bp_set_enable(io, true);
+            b->paused = false;
+            b->paused_cycles += rdtsc() - b->pause_tsc;
+        }
+        if (b->paused) {
+            __atomic_store_n(&consumer.bp_armed, true, __ATOMIC_RELEASE);
+        }
+        break;
+    case BP_CREDIT: {
+        /* Credits the device still holds plus pulses emitted but not yet captured */
+        uint32_t used = queued + io_in32(io, REG_CREDITS) +
+                        (io_in32(io, REG_PULSES_LO) - p->captured_pulses);
+        uint32_t grant = used < PIPE_RING_SLOTS ? PIPE_RING_SLOTS - used : 0;
+        if (grant >= BP_GRANT_MIN) {
+            io_out32(io, REG_CREDITS, grant);
+            b->granted_total += grant;
+            b->grants++;
+        } else {
+            __atomic_store_n(&consumer.bp_armed, true, __ATOMIC_RELEASE);
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+/* Call after pipeline_configure()/pipeline_reset(): credits are tracked against captured pulses */
+static void bp_configure(seL4_X86_IOPort io, bp_t *b, bp_mode_t mode, pipeline_t *p)
+{
+    if (b->paused) {
+        bp_set_enable(io, true);
+    }
+
+    uint8_t ctrl = io_in8(io, REG_CTRL);
+    if (mode == BP_CREDIT) {
+        io_out8(io, REG_CTRL, ctrl | CTRL_CREDIT);
+    } else if (ctrl & CTRL_CREDIT) {
+        io_out8(io, REG_CTRL, ctrl & ~CTRL_CREDIT);
+    }
+
+    memset(b, 0, sizeof(*b));
+    b->mode = mode;
+    b->dev_deferred_base = io_in32(io, REG_DEFERRED);
+    b->dev_starved_base = io_in32(io, REG_STARVED_US);
+    b->dev_toggles_base = io_in32(io, REG_EN_TOGGLES);
+    b->start_tsc = rdtsc();
+    bp_run(io, b, p);
+}
+
+static void bp_report(seL4_X86_IOPort io, bp_t *b, uint32_t tsc_mhz)
+{
+    uint64_t paused = b->paused_cycles + (b->paused ? rdtsc() - b->pause_tsc : 0);
+
+    printf("bp: mode=%s grants=%llu credits-granted=%llu credits=%u deferred=%u pending=%u starved-us=%u pauses=%llu paused-us=%llu en-toggles=%u backlog=%u elapsed-us=%llu\n",
+           bp_mode_names[b->mode],
+           (unsigned long long)b->grants,
+           (unsigned long long)b->granted_total,
+           (unsigned)io_in32(io, REG_CREDITS),
+           (unsigned)(io_in32(io, REG_DEFERRED) - b->dev_deferred_base),
+           (unsigned)io_in32(io, REG_PENDING),
+           (unsigned)(io_in32(io, REG_STARVED_US) - b->dev_starved_base),
+           (unsigned long long)b->pauses,
+           (unsigned long long)cycles_to_us(paused, tsc_mhz),
+           (unsigned)(io_in32(io, REG_EN_TOGGLES) - b->dev_toggles_base),
+           (unsigned)pipe_backlog(),
+           (unsigned long long)cycles_to_us(rdtsc() - b->start_tsc, tsc_mhz));
+}
+
+/*
+ * Port-I/O payload drain. After each interrupt the device exposes
+ * REG_DATA_LEN payload bytes at REG_DATA; the handler reads them with
+ * `width`-byte accesses (one IOPort syscall each) and checks the pattern.
+ * An edge burst can deliver a second notification for a payload already
+ * drained; REG_DATA_AVAIL is 0 then and the drain is skipped, so underruns
+ * never reach `errors` or `seq_gaps`.
+ */
+
+#define PIO_BUF_MAX      4096
+
+typedef struct {
+    uint32_t width;          /* access size in bytes: 1, 2 or 4 */
+    uint32_t len;            /* device payload length, cached at configure */
+    uint8_t buf[PIO_BUF_MAX];
+
+    uint64_t payloads;
+    uint64_t bytes;
+    uint64_t data_syscalls;
+    uint64_t irq_syscalls;   /* Wait + status read + avail read + IRQ ack (+ level ACK) */
+    uint64_t cycles;
+    uint64_t errors;         /* payload bytes that failed verification */
+    uint64_t seq_gaps;       /* payloads replaced before we got to them */
+    uint64_t empty;          /* notifications with no unread payload */
+    uint32_t next_seq;
+    uint64_t start_tsc;
+
+    uint32_t dev_bytes_base;
+    uint32_t dev_drops_base;
+    uint32_t dev_under_base;
+} pio_t;
+
+static void pio_configure(seL4_X86_IOPort io, pio_t *p, uint32_t width)
+{
+    p->width = width;
+    p->len = io_in32(io, REG_DATA_LEN);
+    if (p->len > PIO_BUF_MAX) {
+        p->len = PIO_BUF_MAX;
+    }
+    p->payloads = 0;
+    p->bytes = 0;
+    p->data_syscalls = 0;
+    p->irq_syscalls = 0;
+    p->cycles = 0;
+    p->errors = 0;
+    p->seq_gaps = 0;
+    p->empty = 0;
+    p->next_seq = 0;
+    p->dev_bytes_base = io_in32(io, REG_DATA_BYTES);
+    p->dev_drops_base = io_in32(io, REG_DATA_DROPS);
+    p->dev_under_base = io_in32(io, REG_DATA_UNDER);
+    p->start_tsc = rdtsc();
+}
+
+/* Same pattern the device generates: seq in bytes 0-3, then (seq + i) */
+static void pio_verify(pio_t *p)
+{
+    if (p->len < 4) {
+        return;
+    }
+
+    uint32_t seq;
+    memcpy(&seq, p->buf, sizeof(seq));
+    if (p->payloads > 1 && seq != p->next_seq) {
+        p->seq_gaps++;
+    }
+    p->next_seq = seq + 1;
+
+    for (uint32_t i = 4; i < p->len; i++) {
+        if (p->buf[i] != (uint8_t)(seq + i)) {
+            p->errors++;
+        }
+    }
+}
+
+static void pio_run(seL4_X86_IOPort io, pio_t *p, bool acked)
+{
+    uint64_t t0 = rdtsc();
+    uint32_t avail = io_in32(io, REG_DATA_AVAIL);
+    uint32_t pos = 0;
+
+    p->irq_syscalls += acked ? 5 : 4;
+    if (avail != p->len) {
+        /* Nothing fresh (or a payload cut short by a length change): leave it */
+        p->empty++;
+        p->cycles += rdtsc() - t0;
+        return;
+    }
+
+    while (pos < p->len) {
+        uint32_t v;
+        switch (p->width) {
+        case 1:
+            v = io_in8(io, REG_DATA);
+            break;
+        case 2:
+            v = io_in16(io, REG_DATA);
+            break;
+        default:
+            v = io_in32(io, REG_DATA);
+            break;
+        }
+        uint32_t n = (p->len - pos < p->width) ? p->len - pos : p->width;
+        memcpy(&p->buf[pos], &v, n);
+        pos += n;
+        p->data_syscalls++;
+    }
+
+    p->payloads++;
+    p->bytes += p->len;
+    pio_verify(p);
+    p->cycles += rdtsc() - t0;
+}
+
+static void pio_report(seL4_X86_IOPort io, pio_t *p, uint32_t tsc_mhz)
+{
+    uint64_t dtsc = rdtsc() - p->start_tsc;
+    uint64_t syscalls = p->data_syscalls + p->irq_syscalls;
+
+    printf("pio: width=%u len=%u payloads=%llu bytes=%llu bytes-per-s=%llu syscalls=%llu syscalls-per-kb=%llu bytes-per-syscall=%llu cycles-per-byte=%llu errors=%llu seq-gaps=%llu empty=%llu dev-bytes=%u dev-drops=%u dev-underruns=%u\n",
+           (unsigned)(p->width * 8),
+           (unsigned)p->len,
+           (unsigned long long)p->payloads,
+           (unsigned long long)p->bytes,
+           (unsigned long long)per_s(p->bytes, dtsc, tsc_mhz),
+           (unsigned long long)syscalls,
+           (unsigned long long)avg_or_zero(syscalls * 1024, p->bytes),
+           (unsigned long long)avg_or_zero(p->bytes, syscalls),
+           (unsigned long long)avg_or_zero(p->cycles, p->bytes),
+           (unsigned long long)p->errors,
+           (unsigned long long)p->seq_gaps,
+           (unsigned long long)p->empty,
+           (unsigned)(io_in32(io, REG_DATA_BYTES) - p->dev_bytes_base),
+           (unsigned)(io_in32(io, REG_DATA_DROPS) - p->dev_drops_base),
+           (unsigned)(io_in32(io, REG_DATA_UNDER) - p->dev_under_base));
+}
+
+/*
+ * Weighted fair servicing of several storm sources from this one thread.
+ *
+ * A source's pending work is how far its REG_PULSES_LO has grown since the
+ * handler last looked, sampled when the source's badge arrives. Each wakeup
+ * runs one weighted round-robin round: every backlogged source serves up to
+ * quantum * weight events. This is deficit round-robin with unit-cost
+ * events, where no deficit can carry over: a source either uses its whole
+ * quota or runs dry, which forfeits the rest. While work remains the main loop
+ * polls instead of blocking, so new IRQs interleave with the rounds. Polling
+ * never lets a lower-priority thread run, so every FAIR_POLL_STREAK rounds
+ * the handler drops below the console for one pass; otherwise the console
+ * could never post a request under overload.
+ */
+
+#define FAIR_SOURCES     3
+#define FAIR_BATCHES     64 /* arrival stamps per source, power of two */
+#define FAIR_WORK_WORDS  64 /* per-event checksum work, 256 bytes */
+#define FAIR_WEIGHT_MAX  64
+#define FAIR_POLL_STREAK 16 /* consecutive polled rounds before yielding */
+#define FAIR_YIELD_PRIO  (CONSOLE_PRIO - 1)
+
+/* Register `reg` (an absolute REG_* of the primary device) on another source */
+#define SRC_REG(src, reg) ((uint16_t)((src)->iobase + ((reg) - STORM_IOBASE)))
+
+typedef struct {
+    uint16_t iobase;
+    uint8_t irq;
+    seL4_Word badge;
+} fair_source_cfg_t;
+
+/* Source 0 is the primary device, the others optional extra isa-irq-storm instances */
+static const fair_source_cfg_t fair_source_cfg[FAIR_SOURCES] = {
+    { STORM_IOBASE,                    STORM_IRQ, STORM_BADGE },
+    { STORM_IOBASE + STORM_IOSIZE,     10,        STORM2_BADGE },
+    { STORM_IOBASE + 2 * STORM_IOSIZE, 11,        STORM3_BADGE },
+};
+
+typedef struct {
+    uint32_t n;
+    uint64_t tsc;
+} fair_batch_t;
+
+typedef struct {
+    uint16_t iobase;
+    seL4_Word badge;
+    seL4_X86_IOPort io;
+    seL4_CPtr irq_handler;   /* unused for source 0, acked on the main path */
+    bool present;
+
+    uint32_t weight;
+    uint32_t pending;
+    uint32_t seen_pulses;
+    fair_batch_t batch[FAIR_BATCHES];
+    uint32_t batch_head;
+    uint32_t batch_tail;
+    uint32_t work[FAIR_WORK_WORDS];
+    uint32_t csum;
+
+    uint64_t irqs;
+    uint64_t arrived;
+    uint64_t served;
+    uint64_t lat_cycles;     /* arrival sample -> service, summed per event */
+    uint64_t lat_max;
+} fair_source_t;
+
+typedef struct {
+    fair_source_t src[FAIR_SOURCES];
+    uint32_t quantum;
+    uint64_t rounds;
+    uint64_t polls;
+    uint32_t poll_streak;
+    uint64_t yields;
+    uint64_t intake_cycles;
+    uint64_t sched_cycles;   /* round bookkeeping, excluding the event work */
+    uint64_t work_cycles;
+} fair_t;
+
+static void fair_sources_init(cslot_window_t *win, fair_t *f, seL4_CPtr ntfn,
+                              seL4_X86_IOPort io)
+{
+    f->src[0].iobase = STORM_IOBASE;
+    f->src[0].badge = STORM_BADGE;
+    f->src[0].io = io;
+    f->src[0].present = true;
+
+    for (int i = 1; i < FAIR_SOURCES; i++) {
+        const fair_source_cfg_t *cfg = &fair_source_cfg[i];
+        fair_source_t *src = &f->src[i];
+        seL4_CPtr ioport_slot = cslot_alloc_or_die(win);
+
+        seL4_Error err = seL4_X86_IOPortControl_Issue(
+            seL4_CapIOPortControl,
+            cfg->iobase,
+            (uint16_t)(cfg->iobase + STORM_IOSIZE - 1),
+            seL4_CapInitThreadCNode,
+            ioport_slot,
+            seL4_WordBits
+        );
+        assert(err == 0);
+
+        src->iobase = cfg->iobase;
+        src->badge = cfg->badge;
+        src->io = (seL4_X86_IOPort)ioport_slot;
+        /* An empty ISA range reads back 0xff */
+        src->present = io_in8(src->io, SRC_REG(src, REG_IRQ)) == cfg->irq;
+        printf("fair: src=%d iobase=0x%x irq=%u %s\n", i, (unsigned)cfg->iobase,
+               (unsigned)cfg->irq, src->present ? "present" : "absent");
+        if (!src->present) {
+            continue;
+        }
+
+        src->irq_handler = cslot_alloc_or_die(win);
+        err = seL4_IRQControl_GetIOAPIC(
+            seL4_CapIRQControl,
+            seL4_CapInitThreadCNode,
+            src->irq_handler,
+            seL4_WordBits,
+            0,
+            cfg->irq,
+            1,
+            1,
+            cfg->irq
+        );
+        assert(err == 0);
+        err = seL4_IRQHandler_SetNotification(src->irq_handler,
+                                              mint_badged_or_die(win, ntfn, cfg->badge));
+        assert(err == 0);
+        err = seL4_IRQHandler_Ack(src->irq_handler);
+        assert(err == 0);
+    }
+}
+
+static void fair_reset(fair_t *f, uint32_t quantum, const uint32_t *weights)
+{
+    f->quantum = quantum;
+    f->rounds = 0;
+    f->polls = 0;
+    f->poll_streak = 0;
+    f->yields = 0;
+    f->intake_cycles = 0;
+    f->sched_cycles = 0;
+    f->work_cycles = 0;
+
+    for (int i = 0; i < FAIR_SOURCES; i++) {
+        fair_source_t *src = &f->src[i];
+        if (!src->present) {
+            continue;
+        }
+        src->weight = weights[i];
+        src->pending = 0;
+        src->seen_pulses = io_in32(src->io, SRC_REG(src, REG_PULSES_LO));
+        src->batch_head = 0;
+        src->batch_tail = 0;
+        src->irqs = 0;
+        src->arrived = 0;
+        src->served = 0;
+        src->lat_cycles = 0;
+        src->lat_max = 0;
+    }
+}
+
+static void fair_intake(fair_t *f, fair_source_t *src)
+{
+    uint64_t t0 = rdtsc();
+    uint32_t pulses = io_in32(src->io, SRC_REG(src, REG_PULSES_LO));
+    uint32_t n = pulses - src->seen_pulses;
+
+    src->irqs++;
+    src->seen_pulses = pulses;
+    if (n) {
+        src->pending += n;
+        src->arrived += n;
+        if (src->batch_head - src->batch_tail < FAIR_BATCHES) {
+            src->batch[src->batch_head & (FAIR_BATCHES - 1)] = (fair_batch_t){ n, t0 };
+            src->batch_head++;
+        } else {
+            /* Out of stamps: fold into the newest, so latency reads low rather than high */
+            src->batch[(src->batch_head - 1) & (FAIR_BATCHES - 1)].n += n;
+        }
+    }
+    f->intake_cycles += rdtsc() - t0;
+}
+
+/* Status read, level ACK and IRQ ack for the extra sources named in `badge` */
+static void fair_irq(fair_t *f, seL4_Word badge, bool intake)
+{
+    for (int i = 1; i < FAIR_SOURCES; i++) {
+        fair_source_t *src = &f->src[i];
+        if (!src->present || !(badge & src->badge)) {
+            continue;
+        }
+
+        uint8_t status = io_in8(src->io, SRC_REG(src, REG_STATUS));
+        if ((status & STATUS_LEVEL) && (status & STATUS_ASSERT)) {
+            io_out32(src->io, SRC_REG(src, REG_ACK), 1);
+        }
+        seL4_Error err = seL4_IRQHandler_Ack(src->irq_handler);
+        if (err) {
+            printf("IRQHandler_Ack src=%d error: %d\n", i, (int)err);
+        }
+        if (intake) {
+            fair_intake(f, src);
+        }
+    }
+}
+
+static void fair_serve(fair_source_t *src, uint32_t n)
+{
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t a = 1, b = 0;
+        for (uint32_t j = 0; j < FAIR_WORK_WORDS; j++) {
+            a += src->work[j] ^ (uint32_t)(src->served + i);
+            b += a;
+        }
+        src->csum ^= a ^ b;
+    }
+
+    uint64_t now = rdtsc();
+    uint32_t left = n;
+    while (left) {
+        fair_batch_t *fb = &src->batch[src->batch_tail & (FAIR_BATCHES - 1)];
+        uint32_t take = fb->n < left ? fb->n : left;
+        uint64_t lat = now - fb->tsc;
+        src->lat_cycles += lat * take;
+        if (lat > src->lat_max) {
+            src->lat_max = lat;
+        }
+        fb->n -= take;
+        left -= take;
+        if (!fb->n) {
+            src->batch_tail++;
+        }
+    }
+    src->pending -= n;
+    src->served += n;
+}
+
+/* Drop below the console (and consumer) and come straight back, letting them run if ready */
+static void fair_yield(fair_t *f)
+{
+    seL4_Error err = seL4_TCB_SetPriority(seL4_CapInitThreadTCB, seL4_CapInitThreadTCB,
+                                          FAIR_YIELD_PRIO);
+    if (!err) {
+        err = seL4_TCB_SetPriority(seL4_CapInitThreadTCB, seL4_CapInitThreadTCB, seL4_MaxPrio);
+    }
+    if (err) {
+        printf("fair: yield error: %d\n", (int)err);
+    }
+    f->yields++;
+}
+
+static bool fair_backlog(const fair_t *f)
+{
+    for (int i = 0; i < FAIR_SOURCES; i++) {
+        if (f->src[i].pending) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void fair_run(fair_t *f)
+{
+    uint64_t t0 = rdtsc();
+    uint64_t work = 0;
+
+    f->rounds++;
+    for (int i = 0; i < FAIR_SOURCES; i++) {
+        fair_source_t *src = &f->src[i];
+        if (!src->pending) {
+            continue;
+        }
+        uint32_t quota = f->quantum * src->weight;
+        uint32_t n = quota < src->pending ? quota : src->pending;
+
+        uint64_t w0 = rdtsc();
+        fair_serve(src, n);
+        work += rdtsc() - w0;
+    }
+    f->work_cycles += work;
+    f->sched_cycles += rdtsc() - t0 - work;
+}
+
+static void fair_report(fair_t *f, uint32_t tsc_mhz)
+{
+    uint64_t served = 0;
+    uint32_t weights = 0;
+    for (int i = 0; i < FAIR_SOURCES; i++) {
+        if (f->src[i].present) {
+            served += f->src[i].served;
+            weights += f->src[i].weight;
+        }
+    }
+
+    for (int i = 0; i < FAIR_SOURCES; i++) {
+        fair_source_t *src = &f->src[i];
+        if (!src->present) {
+            continue;
+        }
+        printf("fair: src=%d iobase=0x%x weight=%u irqs=%llu arrived=%llu served=%llu pending=%u share-pct=%llu weight-pct=%u avg-lat-us=%llu max-lat-us=%llu\n",
+               i, (unsigned)src->iobase, (unsigned)src->weight,
+               (unsigned long long)src->irqs,
+               (unsigned long long)src->arrived,
+               (unsigned long long)src->served,
+               (unsigned)src->pending,
+               (unsigned long long)avg_or_zero(src->served * 100, served),
+               (unsigned)(weights ? src->weight * 100 / weights : 0),
+               (unsigned long long)cycles_to_us(avg_or_zero(src->lat_cycles, src->served), tsc_mhz),
+               (unsigned long long)cycles_to_us(src->lat_max, tsc_mhz));
+    }
+
+    printf("fair: quantum=%u rounds=%llu polls=%llu yields=%llu events=%llu intake-cycles-per-event=%llu sched-cycles-per-event=%llu work-cycles-per-event=%llu\n",
+           (unsigned)f->quantum,
+           (unsigned long long)f->rounds,
+           (unsigned long long)f->polls,
+           (unsigned long long)f->yields,
+           (unsigned long long)served,
+           (unsigned long long)avg_or_zero(f->intake_cycles, served),
+           (unsigned long long)avg_or_zero(f->sched_cycles, served),
+           (unsigned long long)avg_or_zero(f->work_cycles, served));
+}
+
+/*
+ * Background DMA load. The device alternately writes and reads `len` bytes of
+ * a reserved RAM region at `bw_mibs` while it keeps raising interrupts, so the
+ * handler runs against real memory-bus and cache pressure.
+ */
+
+#define DMA_REGION_BITS  20 /* 1 MiB */
+
+typedef struct {
+    uint64_t paddr;
+    uint32_t bw_mibs;        /* 0 = off */
+    uint32_t len;
+    uint64_t bytes_base;
+    uint32_t errors_base;
+    uint64_t start_tsc;
+} dma_t;
+
+static void dma_configure(seL4_X86_IOPort io, dma_t *d, uint32_t bw_mibs, uint32_t len)
+{
+    uint8_t ctrl = io_in8(io, REG_CTRL) & ~CTRL_DMA;
+
+    io_out8(io, REG_CTRL, ctrl);
+    io_out32(io, REG_DMA_ADDR_LO, (uint32_t)d->paddr);
+    io_out32(io, REG_DMA_ADDR_HI, (uint32_t)(d->paddr >> 32));
+    io_out32(io, REG_DMA_LEN, len);
+    io_out32(io, REG_DMA_BW_MIBS, bw_mibs);
+    if (bw_mibs) {
+        io_out8(io, REG_CTRL, ctrl | CTRL_DMA);
+    }
+
+    d->bw_mibs = bw_mibs;
+    d->len = len;
+    d->bytes_base = read_u64_lohi_stable(io, REG_DMA_BYTES_LO, REG_DMA_BYTES_HI);
+    d->errors_base = io_in32(io, REG_DMA_ERRORS);
+    d->start_tsc = rdtsc();
+}
+
+static void dma_report(seL4_X86_IOPort io, dma_t *d, uint32_t tsc_mhz)
+{
+    uint64_t tsc = rdtsc();
+    uint64_t bytes = read_u64_lohi_stable(io, REG_DMA_BYTES_LO, REG_DMA_BYTES_HI);
+    uint32_t errors = io_in32(io, REG_DMA_ERRORS);
+    uint64_t dbytes = bytes - d->bytes_base;
+    uint64_t dtsc = tsc - d->start_tsc;
+
+    printf("dma: bw-mibs=%u len=%u paddr=0x%llx bytes=%llu achieved-mibs=%llu errors=%u total_bytes=%llu\n",
+           (unsigned)d->bw_mibs,
+           (unsigned)d->len,
+           (unsigned long long)d->paddr,
+           (unsigned long long)dbytes,
+           (unsigned long long)(per_s(dbytes, dtsc, tsc_mhz) >> 20),
+           (unsigned)(errors - d->errors_base),
+           (unsigned long long)bytes);
+
+    d->bytes_base = bytes;
+    d->errors_base = errors;
+    d->start_tsc = tsc;
+}
+
+/* Console: commands arrive on COM2, results go to the log via the handler thread */
+
+#define CONSOLE_LINE_MAX 80
+#define CONSOLE_ARGS_MAX 6
+
+#define REQ_LOG          (1u << 0)
+#define REQ_STATUS       (1u << 1)
+#define REQ_RESET        (1u << 2)
+#define REQ_HIST         (1u << 3)
+#define REQ_SWEEP        (1u << 4)
+#define REQ_SWEEP_STOP   (1u << 5)
+#define REQ_PIPE         (1u << 6)
+#define REQ_IDLE         (1u << 7)
+#define REQ_PIO          (1u << 8)
+#define REQ_DMA          (1u << 9)
+#define REQ_BP           (1u << 10)
+#define REQ_FAIR         (1u << 11)
+#define REQ_LEVEL        (1u << 12)
+#define REQ_ENABLE       (1u << 13)
+
+typedef enum {
+    HANDLER_MINIMAL,   /* status read + ACK only */
+    HANDLER_PIPELINE,  /* plus the batched event pipeline */
+    HANDLER_PIO,       /* plus draining the port-I/O payload */
+    HANDLER_FAIR,      /* weighted fair servicing across all storm sources */
+    HANDLER_MODES,
+} handler_mode_t;
+
+static const char *const handler_mode_names[HANDLER_MODES] = {
+    "minimal", "pipeline", "pio", "fair",
+};
+
+/*
+ * Written by the console thread, consumed by the handler thread when it sees
+ * CONSOLE_BADGE. The console runs at lower priority, so the handler preempts
+ * it on seL4_Signal and never observes a half-written request.
+ */
+typedef struct {
+    uint32_t requests;
+    uint64_t report_every;
+    uint32_t sweep_from_us;
+    uint32_t sweep_to_us;
+    uint32_t sweep_reports;
+    handler_mode_t handler_mode;
+    uint32_t pio_width;
+    idle_mode_t idle_mode;
+    bool measure_latency;
+    uint32_t pipe_batch[PIPE_STAGES];
+    uint32_t pipe_payload;
+    uint32_t dma_bw_mibs;
+    uint32_t dma_len;
+    bp_mode_t bp_mode;
+    uint32_t fair_quantum;
+    uint32_t fair_weight[FAIR_SOURCES];
+    bool level;
+    bool enable;
+    char line[CONSOLE_LINE_MAX];
+} storm_ctl_t;
+
+static storm_ctl_t ctl = {
+    .report_every = 1ULL << 16, /* 65536 */
+    .handler_mode = HANDLER_MINIMAL,
+    .idle_mode = IDLE_HALT,
+    .measure_latency = false,
+    .pio_width = 4,
+    .pipe_batch = { 16, 16, 16, 16 },
+    .pipe_payload = 256,
+    .dma_bw_mibs = 0,
+    .dma_len = BIT(DMA_REGION_BITS),
+    .bp_mode = BP_OFF,
+    .fair_quantum = 16,
+    .fair_weight = { 1, 1, 1 },
+};
+
+typedef struct {
+    seL4_X86_IOPort uart;
+    seL4_CPtr ntfn;
+    seL4_CPtr irq_handler;
+    seL4_CPtr handler_ntfn; /* badged with CONSOLE_BADGE */
+    seL4_X86_IOPort dev;
+    char buf[CONSOLE_LINE_MAX];
+    unsigned len;
+} console_t;
+
+static console_t console;
+static thread_mem_t console_mem;
+
+static void uart_init(seL4_X86_IOPort uart)
+{
+    io_out8(uart, UART_IER, 0);
+    io_out8(uart, UART_LCR, UART_LCR_DLAB);
+    io_out8(uart, UART_DLL, 1); /* 115200 */
+    io_out8(uart, UART_DLM, 0);
+    io_out8(uart, UART_LCR, UART_LCR_8N1);
+    io_out8(uart, UART_FCR, UART_FCR_ENABLE);
+    io_out8(uart, UART_MCR, UART_MCR_DTR_RTS | UART_MCR_OUT2);
+    io_out8(uart, UART_IER, UART_IER_RDA);
+}
+
+static void uart_putc(seL4_X86_IOPort uart, char c)
+{
+    while (!(io_in8(uart, UART_LSR) & UART_LSR_THRE)) {
+    }
+    io_out8(uart, UART_THR, (uint8_t)c);
+}
+
+static void uart_puts(seL4_X86_IOPort uart, const char *s)
+{
+    while (*s) {
+        if (*s == '\n') {
+            uart_putc(uart, '\r');
+        }
+        uart_putc(uart, *s++);
+    }
+}
+
+static bool parse_u32(const char *s, uint32_t *out)
+{
+    char *end;
+    unsigned long v = strtoul(s, &end, 0);
+    if (*s == '\0' || *end != '\0' || v > UINT32_MAX) {
+        return false;
+    }
+    *out = (uint32_t)v;
+    return true;
+}
+
+static void console_post(console_t *con, uint32_t reqs)
+{
+    __atomic_fetch_or(&ctl.requests, reqs, __ATOMIC_RELEASE);
+    seL4_Signal(con->handler_ntfn);
+}
+
+static bool cmd_period(console_t *con, int argc, char **argv)
+{
+    uint32_t v;
+    if (argc != 2 || !parse_u32(argv[1], &v) || v == 0) {
+        return false;
+    }
+    io_out32(con->dev, REG_PERIOD_US, v);
+    return true;
+}
+
+static bool cmd_burst(console_t *con, int argc, char **argv)
+{
+    uint32_t v;
+    if (argc != 2 || !parse_u32(argv[1], &v) || v == 0) {
+        return false;
+    }
+    io_out32(con->dev, REG_BURST, v);
+    return true;
+}
+
+/*
+ * REG_CTRL is also rewritten by the handler (bp toggle, credit and DMA bits),
+ * so the console never read-modify-writes it; the handler applies the change.
+ */
+static bool cmd_mode(console_t *con, int argc, char **argv)
+{
+    if (argc != 2) {
+        return false;
+    }
+    if (!strcmp(argv[1], "edge")) {
+        ctl.level = false;
+    } else if (!strcmp(argv[1], "level")) {
+        ctl.level = true;
+    } else {
+        return false;
+    }
+    console_post(con, REQ_LEVEL);
+    return true;
+}
+
+static bool cmd_enable(console_t *con, int argc, char **argv)
+{
+    if (argc != 2) {
+        return false;
+    }
+    if (!strcmp(argv[1], "on")) {
+        ctl.enable = true;
+    } else if (!strcmp(argv[1], "off")) {
+        ctl.enable = false;
+    } else {
+        return false;
+    }
+    console_post(con, REQ_ENABLE);
+    return true;
+}
+
+static bool cmd_report(console_t *con, int argc, char **argv)
+{
+    uint32_t v;
+    (void)con;
+    if (argc != 2 || !parse_u32(argv[1], &v) || v == 0) {
+        return false;
+    }
+    ctl.report_every = v;
+    return true;
+}
+
+static bool cmd_reset(console_t *con, int argc, char **argv)
+{
+    (void)argv;
+    if (argc != 1) {
+        return false;
+    }
+    console_post(con, REQ_RESET);
+    return true;
+}
+
+static bool cmd_hist(console_t *con, int argc, char **argv)
+{
+    (void)argv;
+    if (argc != 1) {
+        return false;
+    }
+    console_post(con, REQ_HIST);
+    return true;
+}
+
+static bool cmd_status(console_t *con, int argc, char **argv)
+{
+    (void)argv;
+    if (argc != 1) {
+        return false;
+    }
+    console_post(con, REQ_STATUS);
+    return true;
+}
+
+static bool cmd_sweep(console_t *con, int argc, char **argv)
+{
+    uint32_t from, to, reports = 4;
+
+    if (argc == 2 && !strcmp(argv[1], "stop")) {
+        console_post(con, REQ_SWEEP_STOP);
+        return true;
+    }
+    if (argc < 3 || argc > 4 ||
+        !parse_u32(argv[1], &from) || !parse_u32(argv[2], &to) ||
+        (argc == 4 && !parse_u32(argv[3], &reports)) ||
+        from == 0 || to == 0 || reports == 0) {
+        return false;
+    }
+    ctl.sweep_from_us = from;
+    ctl.sweep_to_us = to;
+    ctl.sweep_reports = reports;
+    console_post(con, REQ_SWEEP);
+    return true;
+}
+
+static bool cmd_handler(console_t *con, int argc, char **argv)
+{
+    if (argc != 2) {
+        return false;
+    }
+    for (int m = 0; m < HANDLER_MODES; m++) {
+        if (!strcmp(argv[1], handler_mode_names[m])) {
+            ctl.handler_mode = (handler_mode_t)m;
+            console_post(con, REQ_PIPE | REQ_PIO);
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool cmd_pipe(console_t *con, int argc, char **argv)
+{
+    uint32_t v;
+    if (argc != 3 || !parse_u32(argv[2], &v)) {
+        return false;
+    }
+    if (!strcmp(argv[1], "payload")) {
+        if (v > PIPE_PAYLOAD_MAX || v % sizeof(uint64_t)) {
+            return false;
+        }
+        ctl.pipe_payload = v;
+    } else if (!strcmp(argv[1], "all")) {
+        if (v == 0 || v > PIPE_SLOTS) {
+            return false;
+        }
+        for (int s = 0; s < PIPE_STAGES; s++) {
+            ctl.pipe_batch[s] = v;
+        }
+    } else {
+        int s;
+        for (s = 0; s < PIPE_STAGES; s++) {
+            if (!strcmp(argv[1], pipe_stage_names[s])) {
+                break;
+            }
+        }
+        if (s == PIPE_STAGES || v == 0 || v > PIPE_SLOTS) {
+            return false;
+        }
+        ctl.pipe_batch[s] = v;
+    }
+    console_post(con, REQ_PIPE);
+    return true;
+}
+
+static bool cmd_pio(console_t *con, int argc, char **argv)
+{
+    uint32_t v;
+    if (argc != 3 || !parse_u32(argv[2], &v)) {
+        return false;
+    }
+    if (!strcmp(argv[1], "width")) {
+        if (v != 8 && v != 16 && v != 32) {
+            return false;
+        }
+        ctl.pio_width = v / 8;
+    } else if (!strcmp(argv[1], "len")) {
+        if (v > PIO_BUF_MAX) {
+            return false;
+        }
+        io_out32(con->dev, REG_DATA_LEN, v);
+    } else {
+        return false;
+    }
+    console_post(con, REQ_PIO);
+    return true;
+}
+
+static bool cmd_idle(console_t *con, int argc, char **argv)
+{
+    if (argc != 2) {
+        return false;
+    }
+    if (!strcmp(argv[1], "halt")) {
+        ctl.idle_mode = IDLE_HALT;
+    } else if (!strcmp(argv[1], "busy")) {
+        ctl.idle_mode = IDLE_BUSY;
+    } else {
+        return false;
+    }
+    console_post(con, REQ_IDLE);
+    return true;
+}
+
+static bool cmd_lat(console_t *con, int argc, char **argv)
+{
+    if (argc != 2) {
+        return false;
+    }
+    if (!strcmp(argv[1], "on")) {
+        ctl.measure_latency = true;
+    } else if (!strcmp(argv[1], "off")) {
+        ctl.measure_latency = false;
+    } else {
+        return false;
+    }
+    console_post(con, REQ_IDLE);
+    return true;
+}
+
+static bool cmd_dma(console_t *con, int argc, char **argv)
+{
+    uint32_t bw, kib = ctl.dma_len / 1024;
+    if (argc == 2 && !strcmp(argv[1], "off")) {
+        bw = 0;
+    } else if (argc < 2 || argc > 3 || !parse_u32(argv[1], &bw) || bw == 0) {
+        return false;
+    } else if (argc == 3 && (!parse_u32(argv[2], &kib) || kib == 0 ||
+                             kib > BIT(DMA_REGION_BITS) / 1024)) {
+        return false;
+    }
+    ctl.dma_bw_mibs = bw;
+    ctl.dma_len = kib * 1024;
+    console_post(con, REQ_DMA);
+    return true;
+}
+
+static bool cmd_bp(console_t *con, int argc, char **argv)
+{
+    if (argc != 2) {
+        return false;
+    }
+    for (int m = 0; m < BP_MODES; m++) {
+        if (!strcmp(argv[1], bp_mode_names[m])) {
+            ctl.bp_mode = m;
+            console_post(con, REQ_BP);
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool cmd_fair(console_t *con, int argc, char **argv)
+{
+    uint32_t v, w;
+    if (argc == 3 && !strcmp(argv[1], "quantum") && parse_u32(argv[2], &v) && v > 0 &&
+        v <= PIPE_RING_SLOTS) {
+        ctl.fair_quantum = v;
+    } else if (argc == 4 && !strcmp(argv[1], "weight") && parse_u32(argv[2], &v) &&
+               v < FAIR_SOURCES && parse_u32(argv[3], &w) && w > 0 && w <= FAIR_WEIGHT_MAX) {
+        ctl.fair_weight[v] = w;
+    } else {
+        return false;
+    }
+    console_post(con, REQ_FAIR);
+    return true;
+}
+
+static bool cmd_help(console_t *con, int argc, char **argv);
+
+typedef struct {
+    const char *name;
+    const char *usage;
+    bool (*fn)(console_t *con, int argc, char **argv);
+} console_cmd_t;
+
+static const console_cmd_t console_cmds[] = {
+    { "help",    "help",                                           cmd_help },
+    { "status",  "status",                                         cmd_status },
+    { "period",  "period <us>",                                    cmd_period },
+    { "burst",   "burst <pulses>",                                 cmd_burst },
+    { "mode",    "mode edge|level",                                cmd_mode },
+    { "enable",  "enable on|off",                                  cmd_enable },
+    { "report",  "report <handled-per-report>",                    cmd_report },
+    { "reset",   "reset",                                          cmd_reset },
+    { "hist",    "hist",                                           cmd_hist },
+    { "sweep",   "sweep <from-us> <to-us> [reports]|stop",         cmd_sweep },
+    { "handler", "handler minimal|pipeline|pio|fair",              cmd_handler },
+    { "pipe",    "pipe <stage>|all <batch>, pipe payload <bytes>", cmd_pipe },
+    { "idle",    "idle halt|busy",                                 cmd_idle },
+    { "lat",     "lat on|off",                                     cmd_lat },
+    { "pio",     "pio width 8|16|32, pio len <bytes>",             cmd_pio },
+    { "dma",     "dma <MiB/s> [len-kib]|off",                      cmd_dma },
+    { "bp",      "bp off|toggle|credit (pipeline handler only)",   cmd_bp },
+    { "fair",    "fair quantum <events>, fair weight <src> <1-64>", cmd_fair },
+};
+
+static bool cmd_help(console_t *con, int argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+    for (size_t i = 0; i < sizeof(console_cmds) / sizeof(console_cmds[0]); i++) {
+        uart_puts(con->uart, "  ");
+        uart_puts(con->uart, console_cmds[i].usage);
+        uart_puts(con->uart, "\n");
+    }
+    return true;
+}
+
+static void console_exec(console_t *con, char *line)
+{
+    char *argv[CONSOLE_ARGS_MAX];
+    int argc = 0;
+
+    for (char *p = line; *p && argc < CONSOLE_ARGS_MAX; ) {
+        while (*p == ' ') {
+            *p++ = '\0';
+        }
+        if (*p) {
+            argv[argc++] = p;
+        }
+        while (*p && *p != ' ') {
+            p++;
+        }
+    }
+    if (argc == 0) {
+        return;
+    }
+
+    for (size_t i = 0; i < sizeof(console_cmds) / sizeof(console_cmds[0]); i++) {
+        const console_cmd_t *cmd = &console_cmds[i];
+        if (strcmp(argv[0], cmd->name)) {
+            continue;
+        }
+        if (!cmd->fn(con, argc, argv)) {
+            uart_puts(con->uart, "usage: ");
+            uart_puts(con->uart, cmd->usage);
+            uart_puts(con->uart, "\n");
+            return;
+        }
+        /* Log the accepted command next to the reports it affects */
+        char *out = ctl.line;
+        for (int a = 0; a < argc; a++) {
+            size_t room = sizeof(ctl.line) - (size_t)(out - ctl.line);
+            int n = snprintf(out, room, a ? " %s" : "%s", argv[a]);
+            if (n < 0 || (size_t)n >= room) {
+                break;
+            }
+            out += n;
+        }
+        console_post(con, REQ_LOG);
+        return;
+    }
+    uart_puts(con->uart, "unknown command, try 'help'\n");
+}
+
+static void console_thread(void *arg)
+{
+    console_t *con = arg;
+
+    uart_puts(con->uart, "isa-irq-storm console, 'help' for commands\n> ");
+    while (1) {
+        seL4_Word badge;
+        seL4_Wait(con->ntfn, &badge);
+
+        while (io_in8(con->uart, UART_LSR) & UART_LSR_DR) {
+            char c = (char)io_in8(con->uart, UART_RBR);
+            if (c == '\r' || c == '\n') {
+                uart_puts(con->uart, "\n");
+                con->buf[con->len] = '\0';
+                console_exec(con, con->buf);
+                con->len = 0;
+                uart_puts(con->uart, "> ");
+            } else if (c == '\b' || c == 0x7f) {
+                if (con->len) {
+                    con->len--;
+                    uart_puts(con->uart, "\b \b");
+                }
+            } else if (c >= ' ' && con->len < sizeof(con->buf) - 1) {
+                con->buf[con->len++] = c;
+                uart_putc(con->uart, c);
+            }
+        }
+
+        seL4_Error err = seL4_IRQHandler_Ack(con->irq_handler);
+        if (err) {
+            printf("console IRQHandler_Ack error: %d\n", (int)err);
+        }
+    }
+}
+
+static void console_start(seL4_BootInfo *bi, cslot_window_t *win, seL4_CPtr handler_ntfn,
+                          seL4_X86_IOPort dev)
+{
+    seL4_CPtr ntfn_slot   = cslot_alloc_or_die(win);
+    seL4_CPtr irqh_slot   = cslot_alloc_or_die(win);
+    seL4_CPtr ioport_slot = cslot_alloc_or_die(win);
+
+    retype_or_die(bi, seL4_NotificationObject, seL4_NotificationBits, ntfn_slot);
+
+    seL4_Error err = seL4_X86_IOPortControl_Issue(
+        seL4_CapIOPortControl,
+        CONSOLE_IOBASE,
+        (uint16_t)(CONSOLE_IOBASE + CONSOLE_IOSIZE - 1),
+        seL4_CapInitThreadCNode,
+        ioport_slot,
+        seL4_WordBits
+    );
+    assert(err == 0);
+
+    /* ISA UART: edge triggered, active high */
+    err = seL4_IRQControl_GetIOAPIC(
+        seL4_CapIRQControl,
+        seL4_CapInitThreadCNode,
+        irqh_slot,
+        seL4_WordBits,
+        0,
+        CONSOLE_IRQ,
+        0,
+        0,
+        CONSOLE_IRQ
+    );
+    assert(err == 0);
+
+    err = seL4_IRQHandler_SetNotification(irqh_slot, ntfn_slot);
+    assert(err == 0);
+
+    console.uart = (seL4_X86_IOPort)ioport_slot;
+    console.ntfn = ntfn_slot;
+    console.irq_handler = irqh_slot;
+    console.handler_ntfn = handler_ntfn;
+    console.dev = dev;
+
+    uart_init(console.uart);
+    err = seL4_IRQHandler_Ack(console.irq_handler);
+    assert(err == 0);
+
+    (void)spawn_thread_or_die(bi, win, &console_mem, console_thread, &console, CONSOLE_PRIO, true);
+}
+
+/* Startup profiling: TSC stamp at the end of each bring-up stage of main() */
+
+enum {
+    BOOT_BOOTINFO,
+    BOOT_SIMPLE,
+    BOOT_BANNER,
+    BOOT_CSLOTS,
+    BOOT_RETYPE,
+    BOOT_IOPORT,
+    BOOT_IRQ,
+    BOOT_DEVICE,
+    BOOT_THREADS,
+    BOOT_FIRST_IRQ,
+    BOOT_STAGES,
+};
+
+static const char *const boot_stage_names[BOOT_STAGES] = {
+    "bootinfo", "simple-init", "banner", "cslot-reserve", "untyped-retype",
+    "ioport-issue", "ioapic-handler", "device-probe", "threads", "first-wait",
+};
+
+static uint64_t boot_tsc_entry;
+static uint64_t boot_tsc[BOOT_STAGES];
+
+static inline void boot_mark(int stage)
+{
+    boot_tsc[stage] = rdtsc();
+}
+
+static void boot_report(seL4_X86_IOPort io, uint32_t tsc_mhz)
+{
+    uint64_t prev = boot_tsc_entry;
+
+    for (int i = 0; i < BOOT_STAGES; i++) {
+        uint64_t cycles = boot_tsc[i] - prev;
+        printf("startup: stage=%s cycles=%llu us=%llu\n",
+               boot_stage_names[i],
+               (unsigned long long)cycles,
+               (unsigned long long)cycles_to_us(cycles, tsc_mhz));
+        prev = boot_tsc[i];
+    }
+
+    /* TSC at main() entry approximates time since reset; device times are QEMU virtual */
+    uint64_t total = boot_tsc[BOOT_FIRST_IRQ] - boot_tsc_entry;
+    printf("startup: total-cycles=%llu total-us=%llu main-entry-us=%llu dev-first-irq-us=%u dev-first-ack-us=%u\n",
+           (unsigned long long)total,
+           (unsigned long long)cycles_to_us(total, tsc_mhz),
+           (unsigned long long)cycles_to_us(boot_tsc_entry, tsc_mhz),
+           (unsigned)io_in32(io, REG_FIRST_IRQ),
+           (unsigned)io_in32(io, REG_FIRST_ACK));
+}
+
+int main(void)
+{
+    boot_tsc_entry = rdtsc();
+
+    seL4_BootInfo *bi = platsupport_get_bootinfo();
+    assert(bi);
+    uint32_t tsc_mhz = bootinfo_tsc_mhz(bi);
+    boot_mark(BOOT_BOOTINFO);
+
+    simple_default_init_bootinfo(&simple, bi);
+    boot_mark(BOOT_SIMPLE);
+
+    printf("seL4 pc99: isa-irq-storm demo start (new device, no DebugRunTime)\n");
+    printf("env: guest=sel4 tsc-mhz=%u\n", (unsigned)tsc_mhz);
+    boot_mark(BOOT_BANNER);
+
+    cslot_window_t win = reserve_cslot_window_from_end(bi, 32);
+
+    seL4_CPtr ntfn_slot   = cslot_alloc_or_die(&win);
+    seL4_CPtr irqh_slot   = cslot_alloc_or_die(&win);
+    seL4_CPtr ioport_slot = cslot_alloc_or_die(&win);
+    (void)cslot_alloc_or_die(&win);
+    boot_mark(BOOT_CSLOTS);
+
+    retype_or_die(bi, seL4_NotificationObject, seL4_NotificationBits, ntfn_slot);
+    seL4_CPtr ntfn = ntfn_slot;
+    boot_mark(BOOT_RETYPE);
+
+    seL4_Error err = seL4_X86_IOPortControl_Issue(
+        seL4_CapIOPortControl,
+        STORM_IOBASE,
+        (uint16_t)(STORM_IOBASE + STORM_IOSIZE - 1),
+        seL4_CapInitThreadCNode,
+        ioport_slot,
+        seL4_WordBits
+    );
+    assert(err == 0);
+    seL4_X86_IOPort io = (seL4_X86_IOPort)ioport_slot;
+    boot_mark(BOOT_IOPORT);
+
+    err = seL4_IRQControl_GetIOAPIC(
+        seL4_CapIRQControl,
+        seL4_CapInitThreadCNode,
+        irqh_slot,
+        seL4_WordBits,
+        0,
+        STORM_IRQ,
+        1,
+        1,
+        STORM_IRQ
+    );
+    assert(err == 0);
+    seL4_CPtr irq_handler = irqh_slot;
+
+    err = seL4_IRQHandler_SetNotification(irq_handler, mint_badged_or_die(&win, ntfn, STORM_BADGE));
+    assert(err == 0);
+    err = seL4_IRQHandler_Ack(irq_handler);
+    assert(err == 0);
+    boot_mark(BOOT_IRQ);
+
+    printf("Device reports IRQ line: %u\n", (unsigned)io_in8(io, REG_IRQ));
+    print_cfg(io);
+
+    /* Ensure enabled (do not change LEVEL bit set by QEMU unless you want to) */
+    uint8_t ctrl = io_in8(io, REG_CTRL);
+    if (!(ctrl & CTRL_ENABLE)) {
+        ctrl |= CTRL_ENABLE;
+        io_out8(io, REG_CTRL, ctrl);
+    }
+    static dma_t dma;
+    dma.paddr = dma_region_carve_or_die(bi, &win, DMA_REGION_BITS);
+    static fair_t fair;
+    fair_sources_init(&win, &fair, ntfn, io);
+    boot_mark(BOOT_DEVICE);
+
+    consumer_start(bi, &win, mint_badged_or_die(&win, ntfn, BP_BADGE));
+    seL4_CPtr spinner = spawn_thread_or_die(bi, &win, &spinner_mem, spinner_thread, NULL,
+                                            SPINNER_PRIO, false);
+    idle_mode_t idle = IDLE_HALT;
+    bool measure_latency = ctl.measure_latency;
+    console_start(bi, &win, mint_badged_or_die(&win, ntfn, CONSOLE_BADGE), io);
+
+    /* Reporting cadence: every N handled notifications, retunable from the console */
+    uint64_t report_every_handled = ctl.report_every;
+
+    static storm_stats_t st;
+    stats_reset(io, &st);
+    sweep_t sweep = {0};
+    handler_mode_t mode = ctl.handler_mode;
+    static pipeline_t pipe;
+    static pio_t pio;
+    pio_configure(io, &pio, ctl.pio_width);
+    pipeline_configure(io, &pipe, ctl.pipe_batch, ctl.pipe_payload);
+    static bp_t bp;
+    bp_configure(io, &bp, BP_OFF, &pipe);
+    fair_reset(&fair, ctl.fair_quantum, ctl.fair_weight);
+    boot_mark(BOOT_THREADS);
+
+    bool first_irq = true;
+
+    while (1) {
+        seL4_Word badge = 0;
+        if (mode == HANDLER_FAIR && fair_backlog(&fair)) {
+            /* Work left over from the last round: collect new signals without blocking */
+            if (++fair.poll_streak == FAIR_POLL_STREAK) {
+                fair.poll_streak = 0;
+                fair_yield(&fair);
+            }
+            seL4_Poll(ntfn, &badge);
+            fair.polls++;
+        } else {
+            fair.poll_streak = 0;
+            seL4_Wait(ntfn, &badge);
+        }
+
+        if ((badge & STORM_BADGE) && first_irq) {
+            boot_mark(BOOT_FIRST_IRQ);
+        }
+
+        if (badge & STORM_BADGE) {
+            uint64_t t0 = rdtsc();
+            st.handled++;
+            st.last_badge = badge;
+
+            if (measure_latency) {
+                uint32_t age = io_in32(io, REG_IRQ_AGE_NS);
+                if (age != UINT32_MAX) {
+                    st.lat_total_ns += age;
+                    st.lat_samples++;
+                    hist_add(st.hist_lat_ns, age);
+                }
+            }
+
+            /* Minimal per-IRQ work */
+            uint8_t status = io_in8(io, REG_STATUS);
+            st.last_status = status;
+
+            /* If device is in LEVEL mode and currently asserted, ACK it */
+            bool acked = (status & STATUS_LEVEL) && (status & STATUS_ASSERT);
+            if (mode == HANDLER_PIO) {
+                /* Drain before the ACK so the payload of a level IRQ is never replaced mid-read */
+                pio_run(io, &pio, acked);
+            }
+            /* The first IRQ is always ACKed so the device records its bring-up time */
+            if (acked || first_irq) {
+                io_out32(io, REG_ACK, 1);
+            }
+
+            err = seL4_IRQHandler_Ack(irq_handler);
+            if (err) {
+                printf("IRQHandler_Ack error: %d\n", (int)err);
+            }
+
+            if (mode == HANDLER_PIPELINE) {
+                pipeline_run(io, &pipe, status);
+                bp_run(io, &bp, &pipe);
+            } else if (mode == HANDLER_FAIR) {
+                fair_intake(&fair, &fair.src[0]);
+            }
+
+            uint64_t cycles = rdtsc() - t0;
+            st.cycles_total += cycles;
+            hist_add(st.hist_cycles, cycles);
+
+            if (first_irq) {
+                first_irq = false;
+                boot_report(io, tsc_mhz);
+            }
+
+            if (st.handled - st.report_base >= report_every_handled) {
+                storm_report(io, &st);
+                if (mode == HANDLER_PIPELINE) {
+                    pipeline_report(&pipe, tsc_mhz);
+                    if (bp.mode != BP_OFF) {
+                        bp_report(io, &bp, tsc_mhz);
+                    }
+                } else if (mode == HANDLER_PIO) {
+                    pio_report(io, &pio, tsc_mhz);
+                } else if (mode == HANDLER_FAIR) {
+                    fair_report(&fair, tsc_mhz);
+                }
+                if (dma.bw_mibs) {
+                    dma_report(io, &dma, tsc_mhz);
+                }
+                sweep_tick(io, &st, &sweep);
+            }
+        }
+
+        if (badge & (STORM2_BADGE | STORM3_BADGE)) {
+            fair_irq(&fair, badge, mode == HANDLER_FAIR);
+        }
+
+        if ((badge & BP_BADGE) && mode == HANDLER_PIPELINE) {
+            /* The device may be starved; capture its leftovers so they cannot block a grant */
+            pipeline_flush(io, &pipe, st.last_status);
+            bp_run(io, &bp, &pipe);
+        }
+
+        if (badge & CONSOLE_BADGE) {
+            uint32_t reqs = __atomic_exchange_n(&ctl.requests, 0, __ATOMIC_ACQUIRE);
+
+            report_every_handled = ctl.report_every;
+            if (reqs & REQ_LOG) {
+                printf("console: %s\n", ctl.line);
+            }
+            if (reqs & REQ_RESET) {
+                if (dma.bw_mibs) {
+                    dma_configure(io, &dma, dma.bw_mibs, dma.len);
+                }
+                stats_reset(io, &st);
+                pipeline_reset(io, &pipe);
+                pio_configure(io, &pio, pio.width);
+                bp_configure(io, &bp, bp.mode, &pipe);
+                fair_reset(&fair, fair.quantum, ctl.fair_weight);
+                sweep.active = false;
+            }
+            /* REQ_PIPE switches `mode`; later blocks report on the mode being left */
+            handler_mode_t prev_mode = mode;
+            if (reqs & REQ_PIPE) {
+                /* Drain staged events under the old batch sizes before switching */
+                if (mode == HANDLER_PIPELINE) {
+                    for (int s = PIPE_CLASSIFY; s < PIPE_STAGES; s++) {
+                        pipe_stage(&pipe, s, true);
+                    }
+                    pipeline_report(&pipe, tsc_mhz);
+                }
+                memset(pipe.done, 0, sizeof(pipe.done));
+                mode = ctl.handler_mode;
+                pipeline_configure(io, &pipe, ctl.pipe_batch, ctl.pipe_payload);
+            }
+            if (reqs & (REQ_LEVEL | REQ_ENABLE)) {
+                uint8_t ctrl = io_in8(io, REG_CTRL);
+                if (reqs & REQ_LEVEL) {
+                    ctrl = ctl.level ? (ctrl | CTRL_LEVEL) : (ctrl & ~CTRL_LEVEL);
+                }
+                if ((reqs & REQ_ENABLE) && bp.mode == BP_TOGGLE) {
+                    /* The toggle controller owns CTRL_ENABLE; `bp off` hands it back */
+                    printf("console: enable ignored while bp toggle is active\n");
+                } else if (reqs & REQ_ENABLE) {
+                    ctrl = ctl.enable ? (ctrl | CTRL_ENABLE) : (ctrl & ~CTRL_ENABLE);
+                }
+                io_out8(io, REG_CTRL, ctrl);
+            }
+            if (reqs & (REQ_PIPE | REQ_BP)) {
+                if (bp.mode != BP_OFF) {
+                    bp_report(io, &bp, tsc_mhz);
+                }
+                bp_configure(io, &bp, mode == HANDLER_PIPELINE ? ctl.bp_mode : BP_OFF, &pipe);
+            }
+            if (reqs & (REQ_PIPE | REQ_FAIR)) {
+                if (fair.rounds) {
+                    fair_report(&fair, tsc_mhz);
+                }
+                fair_reset(&fair, ctl.fair_quantum, ctl.fair_weight);
+            }
+            if (reqs & REQ_PIO) {
+                if (prev_mode == HANDLER_PIO && pio.payloads) {
+                    pio_report(io, &pio, tsc_mhz);
+                }
+                pio_configure(io, &pio, ctl.pio_width);
+            }
+            if (reqs & REQ_DMA) {
+                if (dma.bw_mibs) {
+                    dma_report(io, &dma, tsc_mhz);
+                }
+                dma_configure(io, &dma, ctl.dma_bw_mibs, ctl.dma_len);
+            }
+            if (reqs & REQ_IDLE) {
+                measure_latency = ctl.measure_latency;
+                if (ctl.idle_mode != idle) {
+                    idle = ctl.idle_mode;
+                    err = (idle == IDLE_BUSY) ? seL4_TCB_Resume(spinner) : seL4_TCB_Suspend(spinner);
+                    if (err) {
+                        printf("spinner %s error: %d\n", idle == IDLE_BUSY ? "resume" : "suspend", (int)err);
+                    }
+                }
+            }
+            if (reqs & REQ_HIST) {
+                print_hist("handler-cycles", st.hist_cycles);
+                if (st.lat_samples) {
+                    print_hist("irq-latency-ns", st.hist_lat_ns);
+                }
+            }
+            if (reqs & REQ_SWEEP_STOP) {
+                sweep.active = false;
+            }
+            if (reqs & REQ_SWEEP) {
+                sweep_start(io, &st, &sweep, ctl.sweep_from_us, ctl.sweep_to_us, ctl.sweep_reports);
+            }
+            if (reqs & REQ_STATUS) {
+                print_cfg(io);
+                printf("status: handled=%llu report-every=%llu sweep=%s handler=%s idle=%s lat=%s dma-mibs=%u bp=%s\n",
+                       (unsigned long long)st.handled,
+                       (unsigned long long)report_every_handled,
+                       sweep.active ? "on" : "off",
+                       handler_mode_names[mode],
+                       idle == IDLE_BUSY ? "busy" : "halt",
+                       measure_latency ? "on" : "off",
+                       (unsigned)dma.bw_mibs,
+                       bp_mode_names[bp.mode]);
+            }
+        }
+
+        if (mode == HANDLER_FAIR && fair_backlog(&fair)) {
+            fair_run(&fair);
         }
     }
 
@@ -0,0 +1,301 @@
+/*
+ * isa-irq-storm delivery into a guest VM running on seL4.
+ *
+ * Linked into a libsel4vm x86 VMM. The VMM owns the storm IRQ and the
+ * device's I/O ports; every physical interrupt is injected into the guest
+ * as a virtual one and the physical line is only re-armed once the guest
+ * EOIs it. The guest runs the regular Linux driver (irq_storm_linux.c),
+ * which keeps the guest-side counters.
+ *
+ * VMM-side report (every report_every physical IRQs):
+ *   vmm: irqs=.. (+..) injected=.. eoi=.. in-traps=.. out-traps=.. acks=..
+ *        inject-cycles=.. eoi-cycles=.. trap-cycles=.. dtsc=..
+ * where the cycle fields are per-event averages over the interval:
+ *   inject-cycles  notification received -> vm_inject_irq() returned
+ *   eoi-cycles     notification received -> guest EOI (virtual round trip)
+ *   trap-cycles    time in the emulated port handlers (emulated mode only)
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <sel4/sel4.h>
+#include <sel4vm/guest_vm.h>
+#include <sel4vm/guest_irq_controller.h>
+#include <sel4vm/arch/ioports.h>
+
+#include "sel4_vmm_storm.h"
+
+#define REG_ACK          0x1C
+
+#define HIST_BUCKETS     64
+
+typedef struct {
+    uint64_t irqs;
+    uint64_t injected;
+    uint64_t eoi;
+    uint64_t in_traps;
+    uint64_t out_traps;
+    uint64_t acks;          /* guest writes to REG_ACK seen by the VMM */
+    uint64_t inject_cycles;
+    uint64_t eoi_cycles;
+    uint64_t trap_cycles;
+} storm_vmm_counters_t;
+
+static struct {
+    storm_vmm_config_t cfg;
+    vm_vcpu_t *vcpu;
+
+    uint64_t irq_tsc;       /* when the in-flight physical IRQ was received */
+    bool in_flight;
+
+    storm_vmm_counters_t now;
+    storm_vmm_counters_t last;
+    uint64_t last_tsc;
+    uint64_t hist_eoi[HIST_BUCKETS];
+    uint64_t hist_inject[HIST_BUCKETS];
+} vs;
+
+static inline uint64_t rdtsc(void)
+{
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void hist_add(uint64_t *hist, uint64_t v)
+{
+    hist[63 - __builtin_clzll(v | 1)]++;
+}
+
+static void print_hist(const char *name, const uint64_t *hist)
+{
+    uint64_t total = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        total += hist[i];
+    }
+    printf("hist: %s total=%llu\n", name, (unsigned long long)total);
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        if (hist[i]) {
+            printf("hist: %s 2^%d %llu\n", name, i, (unsigned long long)hist[i]);
+        }
+    }
+}
+
+static inline uint64_t avg(uint64_t sum, uint64_t n)
+{
+    return n ? sum / n : 0;
+}
+
+static void storm_vmm_report(void)
+{
+    uint64_t tsc = rdtsc();
+    storm_vmm_counters_t *c = &vs.now, *l = &vs.last;
+
+    printf("vmm: irqs=%llu (+%llu) injected=%llu eoi=%llu in-traps=%llu out-traps=%llu acks=%llu inject-cycles=%llu eoi-cycles=%llu trap-cycles=%llu dtsc=%llu\n",
+           (unsigned long long)c->irqs,
+           (unsigned long long)(c->irqs - l->irqs),
+           (unsigned long long)c->injected,
+           (unsigned long long)c->eoi,
+           (unsigned long long)c->in_traps,
+           (unsigned long long)c->out_traps,
+           (unsigned long long)c->acks,
+           (unsigned long long)avg(c->inject_cycles - l->inject_cycles, c->injected - l->injected),
+           (unsigned long long)avg(c->eoi_cycles - l->eoi_cycles, c->eoi - l->eoi),
+           (unsigned long long)avg(c->trap_cycles - l->trap_cycles,
+                                   (c->in_traps - l->in_traps) + (c->out_traps - l->out_traps)),
+           (unsigned long long)(tsc - vs.last_tsc));
+
+    *l = *c;
+    vs.last_tsc = tsc;
+
+    /* Histograms are cumulative, dump them every 16 reports */
+    if ((c->irqs / vs.cfg.report_every) % 16 == 0) {
+        print_hist("vmm-inject-cycles", vs.hist_inject);
+        print_hist("vmm-eoi-cycles", vs.hist_eoi);
+    }
+}
+
+/* Guest EOI for the storm line: re-arm the physical IRQ */
+static void storm_vmm_irq_ack(vm_vcpu_t *vcpu, int irq, void *cookie)
+{
+    (void)vcpu;
+    (void)irq;
+    (void)cookie;
+
+    if (vs.in_flight) {
+        uint64_t cycles = rdtsc() - vs.irq_tsc;
+        vs.now.eoi++;
+        vs.now.eoi_cycles += cycles;
+        hist_add(vs.hist_eoi, cycles);
+        vs.in_flight = false;
+    }
+
+    seL4_Error err = seL4_IRQHandler_Ack(vs.cfg.irq_handler);
+    if (err) {
+        printf("vmm: IRQHandler_Ack error: %d\n", (int)err);
+    }
+}
+
+void storm_vmm_handle_irq(void)
+{
+    uint64_t t0 = rdtsc();
+
+    vs.now.irqs++;
+    vs.irq_tsc = t0;
+    vs.in_flight = true;
+
+    int err = vm_inject_irq(vs.vcpu, vs.cfg.irq);
+    if (err) {
+        printf("vmm: vm_inject_irq error: %d\n", err);
+        /*
+         * The guest never saw this one, so nothing will EOI it. Re-arm the line
+         * directly so the storm keeps flowing, without counting an EOI.
+         */
+        vs.in_flight = false;
+        seL4_Error ack_err = seL4_IRQHandler_Ack(vs.cfg.irq_handler);
+        if (ack_err) {
+            printf("vmm: IRQHandler_Ack error: %d\n", (int)ack_err);
+        }
+    } else {
+        uint64_t cycles = rdtsc() - t0;
+        vs.now.injected++;
+        vs.now.inject_cycles += cycles;
+        hist_add(vs.hist_inject, cycles);
+    }
+
+    if (vs.now.irqs - vs.last.irqs >= vs.cfg.report_every) {
+        storm_vmm_report();
+    }
+}
+
+/* Emulated mode: every guest access to the device traps here and is forwarded */
+
+static ioport_fault_result_t storm_vmm_port_in(vm_vcpu_t *vcpu, void *cookie, unsigned int port_no,
+                                               unsigned int size, unsigned int *result)
+{
+    uint64_t t0 = rdtsc();
+    (void)vcpu;
+    (void)cookie;
+
+    switch (size) {
+    case 1: {
+        seL4_X86_IOPort_In8_t r = seL4_X86_IOPort_In8(vs.cfg.io, port_no);
+        if (r.error) {
+            return IO_FAULT_ERROR;
+        }
+        *result = r.result;
+        break;
+    }
+    case 2: {
+        seL4_X86_IOPort_In16_t r = seL4_X86_IOPort_In16(vs.cfg.io, port_no);
+        if (r.error) {
+            return IO_FAULT_ERROR;
+        }
+        *result = r.result;
+        break;
+    }
+    case 4: {
+        seL4_X86_IOPort_In32_t r = seL4_X86_IOPort_In32(vs.cfg.io, port_no);
+        if (r.error) {
+            return IO_FAULT_ERROR;
+        }
+        *result = r.result;
+        break;
+    }
+    default:
+        return IO_FAULT_ERROR;
+    }
+
+    vs.now.in_traps++;
+    vs.now.trap_cycles += rdtsc() - t0;
+    return IO_FAULT_HANDLED;
+}
+
+static ioport_fault_result_t storm_vmm_port_out(vm_vcpu_t *vcpu, void *cookie, unsigned int port_no,
+                                                unsigned int size, unsigned int value)
+{
+    uint64_t t0 = rdtsc();
+    int err;
+    (void)vcpu;
+    (void)cookie;
+
+    switch (size) {
+    case 1:
+        err = seL4_X86_IOPort_Out8(vs.cfg.io, port_no, value);
+        break;
+    case 2:
+        err = seL4_X86_IOPort_Out16(vs.cfg.io, port_no, value);
+        break;
+    case 4:
+        err = seL4_X86_IOPort_Out32(vs.cfg.io, port_no, value);
+        break;
+    default:
+        return IO_FAULT_ERROR;
+    }
+    if (err) {
+        return IO_FAULT_ERROR;
+    }
+
+    if (port_no == (unsigned int)vs.cfg.iobase + REG_ACK) {
+        vs.now.acks++;
+    }
+    vs.now.out_traps++;
+    vs.now.trap_cycles += rdtsc() - t0;
+    return IO_FAULT_HANDLED;
+}
+
+int storm_vmm_init(vm_t *vm, vm_vcpu_t *vcpu, const storm_vmm_config_t *cfg)
+{
+    int err;
+
+    if (cfg->report_every == 0) {
+        printf("vmm: storm report_every must be non-zero\n");
+        return -1;
+    }
+
+    memset(&vs, 0, sizeof(vs));
+    vs.cfg = *cfg;
+    vs.vcpu = vcpu;
+
+    vm_ioport_range_t range = {
+        .start = cfg->iobase,
+        .end = (uint16_t)(cfg->iobase + cfg->iosize - 1),
+    };
+
+    if (cfg->mode == STORM_VMM_PASSTHROUGH) {
+        err = vm_enable_passthrough_ioport(vcpu, range.start, range.end);
+    } else {
+        vm_ioport_interface_t iface = {
+            .cookie = NULL,
+            .port_in = storm_vmm_port_in,
+            .port_out = storm_vmm_port_out,
+            .desc = "isa-irq-storm",
+        };
+        err = vm_io_port_add_handler(vm, range, iface);
+    }
+    if (err) {
+        printf("vmm: storm I/O port setup failed: %d\n", err);
+        return err;
+    }
+
+    err = vm_register_irq(vcpu, cfg->irq, storm_vmm_irq_ack, NULL);
+    if (err) {
+        printf("vmm: vm_register_irq(%d) failed: %d\n", cfg->irq, err);
+        return err;
+    }
+
+    vs.last_tsc = rdtsc();
+    printf("vmm: isa-irq-storm irq=%d ports=0x%x-0x%x mode=%s\n",
+           cfg->irq, (unsigned)range.start, (unsigned)range.end,
+           cfg->mode == STORM_VMM_PASSTHROUGH ? "passthrough" : "emulated");
+
+    /* The guest has not EOI'd anything yet; arm the physical line once */
+    seL4_Error ack_err = seL4_IRQHandler_Ack(cfg->irq_handler);
+    if (ack_err) {
+        printf("vmm: IRQHandler_Ack error: %d\n", (int)ack_err);
+    }
+    return 0;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <sel4/sel4.h>
+#include <sel4vm/guest_vm.h>
+
+/*
+ * isa-irq-storm delivery into a guest VM (see sel4_vmm_storm.c).
+ */
+
+typedef enum {
+    STORM_VMM_PASSTHROUGH, /* guest port I/O goes straight to the device */
+    STORM_VMM_EMULATED,    /* guest port I/O traps and the VMM forwards it */
+} storm_vmm_mode_t;
+
+typedef struct {
+    storm_vmm_mode_t mode;
+    seL4_X86_IOPort io;       /* device port range, owned by the VMM */
+    seL4_CPtr irq_handler;    /* storm IRQ, bound to the VMM's notification */
+    uint16_t iobase;
+    uint16_t iosize;
+    int irq;                  /* ISA line, used for both host and guest */
+    uint64_t report_every;    /* physical IRQs per report line */
+} storm_vmm_config_t;
+
+int storm_vmm_init(vm_t *vm, vm_vcpu_t *vcpu, const storm_vmm_config_t *cfg);
+
+/* Call from the VMM event loop when the storm IRQ badge is set */
+void storm_vmm_handle_irq(void);
@@ -0,0 +1,447 @@
+#!/usr/bin/env python3
+"""
+Result store and regression comparison for isa-irq-storm runs.
+
+Serial logs from the guest handlers are parsed into versioned JSON run
+records (schema below) and kept in a local store directory. Two sets of
+runs can then be compared: throughput gets a bootstrap confidence interval
+on the relative change of the per-report-interval mean, latency gets
+bootstrap intervals on quantile ratios taken from the log2 histograms.
+
+    storm_results.py ingest serial.log --label base --tcg-threads 1
+    storm_results.py list
+    storm_results.py compare base candidate
+
+`compare` exits with status 1 when a regression is flagged.
+"""
+
+import argparse
+import datetime
+import json
+import math
+import os
+import platform
+import random
+import re
+import subprocess
+import sys
+
+SCHEMA = "isa-irq-storm-results"
+SCHEMA_VERSION = 1
+
+DEFAULT_STORE = "results"
+
+# Log lines emitted by the guest handlers. A printk/timestamp prefix is allowed.
+RE_KV = re.compile(r"([A-Za-z_][A-Za-z0-9_-]*)=(0x[0-9a-fA-F]+|-?\d+)")
+RE_STORM = re.compile(r"storm: handled=(\d+) \(\+(\d+)\)(.*)$")
+RE_HIST = re.compile(r"hist: (\S+) 2\^(\d+) (\d+)\s*$")
+RE_HIST_TOTAL = re.compile(r"hist: (\S+) total=\d+\s*$")
+RE_ENV = re.compile(r"env: (.*)$")
+RE_CONSOLE = re.compile(r"console: (.*)$")
+
+
+def _int(v):
+    return int(v, 0)
+
+
+def parse_log(lines):
+    """Return (intervals, histograms, guest_env, console_commands)."""
+    intervals = []
+    histograms = {}
+    env = {}
+    console = []
+
+    for line in lines:
+        line = line.rstrip("\r\n")
+        m = RE_STORM.search(line)
+        if m:
+            rec = {"handled": int(m.group(1)), "handled_delta": int(m.group(2))}
+            for k, v in RE_KV.findall(m.group(3)):
+                rec[k.replace("-", "_")] = _int(v)
+            intervals.append(rec)
+            continue
+        m = RE_HIST_TOTAL.search(line)
+        if m:
+            # Every dump starts with its total line; a later dump supersedes the earlier one
+            histograms[m.group(1)] = {}
+            continue
+        m = RE_HIST.search(line)
+        if m:
+            name, bucket, count = m.group(1), int(m.group(2)), int(m.group(3))
+            histograms.setdefault(name, {})[bucket] = count
+            continue
+        m = RE_ENV.search(line)
+        if m:
+            for k, v in RE_KV.findall(m.group(1)):
+                env[k.replace("-", "_")] = _int(v)
+            for k, v in re.findall(r"([A-Za-z_-]+)=([A-Za-z][^\s]*)", m.group(1)):
+                env[k.replace("-", "_")] = v
+            continue
+        m = RE_CONSOLE.search(line)
+        if m:
+            console.append(m.group(1))
+
+    hists = {name: {str(b): c for b, c in sorted(h.items())} for name, h in histograms.items()}
+    return intervals, hists, env, console
+
+
+def host_cpu():
+    try:
+        with open("/proc/cpuinfo") as f:
+            for line in f:
+                if line.startswith("model name"):
+                    return line.split(":", 1)[1].strip()
+    except OSError:
+        pass
+    return platform.processor() or platform.machine()
+
+
+def qemu_version(binary):
+    try:
+        out = subprocess.run([binary, "--version"], capture_output=True, text=True, timeout=10)
+    except (OSError, subprocess.SubprocessError):
+        return None
+    m = re.search(r"version (\S+)", out.stdout)
+    return m.group(1) if m else None
+
+
+def build_record(args, lines):
+    intervals, hists, guest_env, console = parse_log(lines)
+    if args.skip:
+        intervals = intervals[args.skip:]
+    if not intervals:
+        raise SystemExit("no 'storm:' report lines found in log")
+
+    first = intervals[0]
+    created = datetime.datetime.now(datetime.timezone.utc)
+    return {
+        "schema": SCHEMA,
+        "version": SCHEMA_VERSION,
+        "run_id": args.run_id or "%s-%s" % (args.label, created.strftime("%Y%m%dT%H%M%S")),
+        "label": args.label,
+        "created": created.isoformat(),
+        "config": {
+            "period_us": first.get("period_us"),
+            "burst": first.get("burst"),
+            "ctrl": first.get("ctrl"),
+            "report_every": first.get("handled_delta"),
+            "qemu_args": args.qemu_args,
+            "console": console,
+            "notes": args.notes,
+        },
+        "environment": {
+            "qemu_version": args.qemu_version or qemu_version(args.qemu_binary),
+            "tcg_threads": args.tcg_threads,
+            "host_cpu": host_cpu(),
+            "host_kernel": platform.release(),
+            "guest": guest_env.get("guest"),
+            "tsc_mhz": guest_env.get("tsc_mhz") or None,
+            "guest_env": guest_env,
+        },
+        "intervals": intervals,
+        "histograms": hists,
+    }
+
+
+def store_path(store, run_id):
+    return os.path.join(store, run_id + ".json")
+
+
+def load_store(store):
+    runs = []
+    if not os.path.isdir(store):
+        return runs
+    for name in sorted(os.listdir(store)):
+        if not name.endswith(".json"):
+            continue
+        with open(os.path.join(store, name)) as f:
+            rec = json.load(f)
+        if rec.get("schema") != SCHEMA:
+            continue
+        if rec.get("version", 0) > SCHEMA_VERSION:
+            print("warning: %s has newer schema version %s" % (name, rec["version"]), file=sys.stderr)
+        runs.append(rec)
+    return runs
+
+
+def select(runs, selector):
+    """A selector is a run id or a label naming a set of runs."""
+    chosen = [r for r in runs if r["run_id"] == selector]
+    if not chosen:
+        chosen = [r for r in runs if r["label"] == selector]
+    if not chosen:
+        raise SystemExit("no runs match '%s'" % selector)
+    return chosen
+
+
+# Statistics
+
+def throughput_unit(run):
+    return "irq/s" if run["environment"].get("tsc_mhz") else "irq/Mcycle"
+
+
+def throughputs(runs):
+    """Handled interrupts per second (per Mcycle without a TSC rate), one sample per interval."""
+    samples = []
+    for run in runs:
+        mhz = run["environment"].get("tsc_mhz")
+        for iv in run["intervals"]:
+            dtsc = iv.get("dtsc")
+            if not dtsc:
+                continue
+            per_cycle = iv["handled_delta"] / dtsc
+            samples.append(per_cycle * mhz * 1e6 if mhz else per_cycle * 1e6)
+    return samples
+
+
+def merged_hist(runs, name):
+    merged = {}
+    for run in runs:
+        for b, c in run["histograms"].get(name, {}).items():
+            merged[int(b)] = merged.get(int(b), 0) + c
+    return merged
+
+
+def hist_quantile(hist, q):
+    """Quantile of a log2 histogram, interpolated geometrically inside a bucket."""
+    total = sum(hist.values())
+    if total == 0:
+        return None
+    target = q * total
+    seen = 0
+    for b in sorted(hist):
+        c = hist[b]
+        if seen + c >= target:
+            frac = (target - seen) / c if c else 0.0
+            return 2.0 ** (b + frac)
+        seen += c
+    return 2.0 ** (max(hist) + 1)
+
+
+def binomial(rng, n, p):
+    """Binomial(n, p) draw: exact for small variance, normal approximation above."""
+    if n <= 0 or p <= 0:
+        return 0
+    if p >= 1:
+        return n
+    if p > 0.5:
+        return n - binomial(rng, n, 1 - p)
+    var = n * p * (1 - p)
+    if var > 25:
+        return min(n, max(0, int(round(rng.gauss(n * p, math.sqrt(var))))))
+    # Geometric waiting times between successes, O(n * p) draws
+    log_q = math.log1p(-p)
+    x = trials = 0
+    while True:
+        trials += int(math.log(1.0 - rng.random()) / log_q) + 1
+        if trials > n:
+            return x
+        x += 1
+
+
+def hist_resample(hist, rng, n):
+    """Draw n samples from a histogram as one multinomial over its buckets.
+
+    Each bucket takes a binomial share of the draws still left, weighted by
+    its count against the counts still left, so the cost is per bucket
+    rather than per sample.
+    """
+    left = sum(hist.values())
+    out = {}
+    for b in sorted(hist):
+        c = hist[b]
+        k = n if c >= left else binomial(rng, n, c / left)
+        if k:
+            out[b] = k
+        n -= k
+        left -= c
+        if n == 0:
+            break
+    return out
+
+
+def percentile(sorted_vals, p):
+    idx = min(len(sorted_vals) - 1, max(0, int(round(p * (len(sorted_vals) - 1)))))
+    return sorted_vals[idx]
+
+
+def ci_of(vals, alpha):
+    vals = sorted(v for v in vals if v is not None)
+    if not vals:
+        return None, None
+    return percentile(vals, alpha / 2), percentile(vals, 1 - alpha / 2)
+
+
+def bootstrap_ci(stat, rng, iters, alpha):
+    return ci_of((stat() for _ in range(iters)), alpha)
+
+
+def compare_throughput(base, cand, rng, args):
+    units = {}
+    for run in base + cand:
+        units.setdefault(throughput_unit(run), []).append(run["run_id"])
+    if len(units) > 1:
+        raise SystemExit("throughput units differ between runs (%s); runs without a guest "
+                         "tsc-mhz cannot be compared with runs that have one" %
+                         "; ".join("%s: %s" % (u, ", ".join(ids)) for u, ids in sorted(units.items())))
+    unit = next(iter(units))
+
+    b, c = throughputs(base), throughputs(cand)
+    if len(b) < 2 or len(c) < 2:
+        return None
+    mean = lambda xs: sum(xs) / len(xs)
+    point = mean(c) / mean(b) - 1
+
+    def stat():
+        rb = rng.choices(b, k=len(b))
+        rc = rng.choices(c, k=len(c))
+        return mean(rc) / mean(rb) - 1
+
+    lo, hi = bootstrap_ci(stat, rng, args.iterations, args.alpha)
+    regression = hi < 0 and point < -args.threshold
+    return {
+        "metric": "throughput (%s)" % unit,
+        "base": mean(b), "cand": mean(c),
+        "change": point, "ci": (lo, hi),
+        "n": (len(b), len(c)),
+        "regression": regression,
+    }
+
+
+def compare_quantiles(base, cand, name, rng, args):
+    hb, hc = merged_hist(base, name), merged_hist(cand, name)
+    if not hb or not hc:
+        return []
+    nb = min(sum(hb.values()), args.max_samples)
+    nc = min(sum(hc.values()), args.max_samples)
+
+    # One resample per side and iteration serves every quantile
+    draws = [[] for _ in args.quantiles]
+    for _ in range(args.iterations):
+        sb, sc = hist_resample(hb, rng, nb), hist_resample(hc, rng, nc)
+        for i, q in enumerate(args.quantiles):
+            draws[i].append(hist_quantile(sc, q) / hist_quantile(sb, q) - 1)
+
+    results = []
+    for i, q in enumerate(args.quantiles):
+        qb, qc = hist_quantile(hb, q), hist_quantile(hc, q)
+        point = qc / qb - 1
+        lo, hi = ci_of(draws[i], args.alpha)
+        results.append({
+            "metric": "%s p%g" % (name, q * 100),
+            "base": qb, "cand": qc,
+            "change": point, "ci": (lo, hi),
+            "n": (sum(hb.values()), sum(hc.values())),
+            "regression": lo > 0 and point > args.threshold,
+        })
+    return results
+
+
+# Commands
+
+def cmd_ingest(args):
+    with open(args.log, errors="replace") as f:
+        rec = build_record(args, f)
+    os.makedirs(args.store, exist_ok=True)
+    path = store_path(args.store, rec["run_id"])
+    if os.path.exists(path) and not args.force:
+        raise SystemExit("%s exists (use --force to overwrite)" % path)
+    with open(path, "w") as f:
+        json.dump(rec, f, indent=1, sort_keys=True)
+        f.write("\n")
+    print("stored %s: %d intervals, histograms: %s" %
+          (rec["run_id"], len(rec["intervals"]), ", ".join(rec["histograms"]) or "none"))
+    return 0
+
+
+def cmd_list(args):
+    for rec in load_store(args.store):
+        env, cfg = rec["environment"], rec["config"]
+        print("%-32s label=%-12s period-us=%s burst=%s intervals=%d qemu=%s tcg-threads=%s" %
+              (rec["run_id"], rec["label"], cfg.get("period_us"), cfg.get("burst"),
+               len(rec["intervals"]), env.get("qemu_version"), env.get("tcg_threads")))
+    return 0
+
+
+def fmt(v):
+    if v is None:
+        return "n/a"
+    return "%.4g" % v
+
+
+def cmd_compare(args):
+    runs = load_store(args.store)
+    base, cand = select(runs, args.base), select(runs, args.candidate)
+    rng = random.Random(args.seed)
+
+    for side, rs in (("base", base), ("cand", cand)):
+        envs = {(r["environment"].get("qemu_version"), r["environment"].get("tcg_threads"),
+                 r["environment"].get("host_cpu")) for r in rs}
+        print("%s: %d run(s), env %s" % (side, len(rs), "; ".join(str(e) for e in sorted(envs, key=str))))
+
+    results = []
+    tp = compare_throughput(base, cand, rng, args)
+    if tp:
+        results.append(tp)
+    for name in args.hist:
+        results += compare_quantiles(base, cand, name, rng, args)
+    if not results:
+        raise SystemExit("nothing to compare (need >= 2 intervals with dtsc, or histograms)")
+
+    flagged = 0
+    conf = 100 * (1 - args.alpha)
+    for r in results:
+        lo, hi = r["ci"]
+        mark = "REGRESSION" if r["regression"] else "ok"
+        flagged += r["regression"]
+        print("%-28s base=%-10s cand=%-10s change=%+.2f%% %g%% CI [%+.2f%%, %+.2f%%] n=%d/%d %s" %
+              (r["metric"], fmt(r["base"]), fmt(r["cand"]), 100 * r["change"], conf,
+               100 * (lo if lo is not None else math.nan), 100 * (hi if hi is not None else math.nan),
+               r["n"][0], r["n"][1], mark))
+    return 1 if flagged else 0
+
+
+def main(argv=None):
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("--store", default=DEFAULT_STORE, help="result store directory (default: %(default)s)")
+    sub = ap.add_subparsers(dest="cmd", required=True)
+
+    p = sub.add_parser("ingest", help="parse a serial log into a stored run")
+    p.add_argument("log")
+    p.add_argument("--label", required=True, help="set name used by compare")
+    p.add_argument("--run-id")
+    p.add_argument("--skip", type=int, default=1, help="warm-up report intervals to drop (default: %(default)s)")
+    p.add_argument("--qemu-binary", default="qemu-system-x86_64")
+    p.add_argument("--qemu-version", help="override auto-detected QEMU version")
+    p.add_argument("--qemu-args", default="", help="QEMU command line / device properties used")
+    p.add_argument("--tcg-threads", type=int, help="number of TCG threads (-accel tcg,thread=multi)")
+    p.add_argument("--notes", default="")
+    p.add_argument("--force", action="store_true")
+    p.set_defaults(fn=cmd_ingest)
+
+    p = sub.add_parser("list", help="list stored runs")
+    p.set_defaults(fn=cmd_list)
+
+    p = sub.add_parser("compare", help="compare a candidate set against a baseline set")
+    p.add_argument("base", help="run id or label")
+    p.add_argument("candidate", help="run id or label")
+    p.add_argument("--hist", action="append", default=None,
+                   help="histogram to compare (repeatable, default: handler-cycles)")
+    p.add_argument("--quantiles", type=float, nargs="+", default=[0.5, 0.9, 0.99])
+    p.add_argument("--alpha", type=float, default=0.05)
+    p.add_argument("--threshold", type=float, default=0.02,
+                   help="minimum relative change to flag (default: %(default)s)")
+    p.add_argument("--iterations", type=int, default=2000)
+    p.add_argument("--max-samples", type=int, default=20000,
+                   help="cap on histogram samples per bootstrap draw")
+    p.add_argument("--seed", type=int, default=1)
+    p.set_defaults(fn=cmd_compare)
+
+    args = ap.parse_args(argv)
+    if getattr(args, "hist", False) is None:
+        args.hist = ["handler-cycles"]
+    return args.fn(args)
+
+
+if __name__ == "__main__":
+    sys.exit(main())